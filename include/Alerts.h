@@ -0,0 +1,54 @@
+#ifndef ALERTS_H
+#define ALERTS_H
+
+#include <stdint.h>
+
+#include <RuleEngine.h>
+
+// Alert rules (see lib/Rules) evaluated on every sensor read.
+// The rules are kept in LittleFS and replaced by publishing them to <topic>/rules.
+// Alerts are queued here and published by the caller as soon as they are raised.
+
+#define ALERT_RULES_PATH "/rules.txt"
+
+// Also sets the MQTT client's buffer, as the rules arrive in one message
+#define ALERT_RULES_MAX_BYTES 1024
+
+// Used until rules are published to the device
+#define ALERT_DEFAULT_RULES \
+    "co2_high * scd4x_co2 above 1500 1400\n" \
+    "co2_surge * scd4x_co2 rise 300 120\n" \
+    "temp_stale * sht4x_temperature stale 60\n"
+
+// Alerts raised while MQTT is disconnected beyond this are dropped, oldest first
+#define ALERT_QUEUE_LENGTH 8
+
+struct QueuedAlert {
+    char rule[RULES_NAME_LENGTH];
+    // The unit's channel label
+    char channel[8];
+    uint8_t field;
+    bool isTriggered;
+    // See RuleAlert
+    float value;
+    // Unix time in seconds, 0 if the clock hadn't synced
+    uint32_t timestamp;
+};
+
+// Loads the saved rules, or the defaults
+void BeginAlerts();
+
+// Validates, applies and saves new rules. The current rules are kept if they don't parse.
+bool SetAlertRules(const char* text, unsigned int length);
+
+// Call for each unit, by index, after each sensor read. values are in HistoryField order, NAN where absent.
+void EvaluateAlertRules(uint8_t unit, const float values[RULES_FIELD_COUNT], uint32_t timestamp);
+
+bool HasPendingAlert();
+
+// The oldest queued alert, which stays queued until PopAlert
+const QueuedAlert& PeekAlert();
+
+void PopAlert();
+
+#endif
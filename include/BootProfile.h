@@ -0,0 +1,37 @@
+#ifndef BOOT_PROFILE_H
+#define BOOT_PROFILE_H
+
+#include <stdint.h>
+
+#include <ArduinoJson.h>
+
+// Records when each stage of boot is first reached, up to the first successful publish.
+
+enum BootPhase {
+    BOOT_PHASE_SETUP_START = 0,
+    BOOT_PHASE_WIFI_STARTED,
+    BOOT_PHASE_SENSORS_INITIALISED,
+    BOOT_PHASE_SETUP_END,
+    BOOT_PHASE_WIFI_CONNECTED,
+    BOOT_PHASE_WIFI_GOT_IP,
+    BOOT_PHASE_WIFI_CLIENT_CONNECTED,
+    BOOT_PHASE_MQTT_CONNECTED,
+    BOOT_PHASE_NTP_SYNCED,
+    BOOT_PHASE_FIRST_PUBLISH,
+    BOOT_PHASE_COUNT,
+};
+
+// Only the first call for each phase is recorded.
+// Safe to call from the WiFi event task.
+void MarkBootPhase(BootPhase phase);
+
+bool HasReachedBootPhase(BootPhase phase);
+
+// Milliseconds since the app started, not counting the time spent in the bootloader
+uint32_t GetBootPhaseTime(BootPhase phase);
+
+const char* GetBootPhaseName(BootPhase phase);
+
+void WriteBootProfileToJson(JsonDocument& doc);
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+
+// Streams every SHT4x and BMP280 reading over serial as binary frames, for calibration.
+// Decoded on the host by tools/capture_receiver.py.
+// The serial port switches to CAPTURE_BAUD for the capture, and back afterwards.
+//
+// Each frame, little endian:
+//   sync (0xA5 0x5A), type (1 byte), payload length (1 byte),
+//   sequence (uint32), micros() as the read started (uint32), payload,
+//   CRC-16/CCITT-FALSE of everything from the type to the end of the payload (uint16).
+// The sequence counts every frame, so a gap is a lost frame, whether dropped here
+// because the serial buffer was full or corrupted on the way.
+//
+// Payloads:
+//   START:  version (uint8), unit count (uint8), Unix time at this frame or 0 if unsynced (uint32)
+//   SHT4X:  unit (uint8), temperature C (float), humidity %RH (float)
+//   BMP280: unit (uint8), temperature C (float), pressure Pa (float)
+//   STATUS: frames dropped here (uint32), failed reads (uint32); once a second and at the end
+//   END:    as STATUS
+
+// Matches upload_speed, which the USB serial bridges on the ATOM and StickC handle
+#define CAPTURE_BAUD 1500000
+
+// Restored afterwards, matching monitor_speed
+#define CAPTURE_MONITOR_BAUD 115200
+
+// Room for about 50ms of frames at CAPTURE_BAUD, beyond which frames are dropped
+// rather than holding up the next reading
+#define CAPTURE_TX_BUFFER_BYTES 8192
+
+// Time for the host to switch baud rate before the first frame
+#define CAPTURE_START_DELAY_MS 100
+
+#define CAPTURE_STATUS_INTERVAL_MS 1000
+
+// The BMP280's longest conversion at capture sampling (see SetEnvUnitsCaptureSampling)
+// plus its standby; reading more often would repeat a conversion.
+// The SHT4x is read back to back, as each read waits for its own conversion.
+#define CAPTURE_BMP280_INTERVAL_US 44000
+
+#define CAPTURE_SYNC_0 0xA5
+#define CAPTURE_SYNC_1 0x5A
+#define CAPTURE_VERSION 1
+
+// Sync, type, length, sequence and timestamp
+#define CAPTURE_HEADER_BYTES 12
+#define CAPTURE_CRC_BYTES 2
+#define CAPTURE_MAX_PAYLOAD_BYTES 16
+
+enum CaptureFrameType {
+    CAPTURE_FRAME_START = 1,
+    CAPTURE_FRAME_SHT4X,
+    CAPTURE_FRAME_BMP280,
+    CAPTURE_FRAME_STATUS,
+    CAPTURE_FRAME_END,
+};
+
+// The caller suspends anything else which writes to serial.
+// unixTime is 0 if the clock hasn't synced.
+void StartCapture(uint32_t unixTime);
+
+// Sends the END frame and returns the port to CAPTURE_MONITOR_BAUD
+void StopCapture();
+
+bool IsCapturing();
+
+// Call continuously while capturing. Reads whichever sensors are due.
+void UpdateCapture();
+
+#endif
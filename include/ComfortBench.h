@@ -0,0 +1,12 @@
+#ifndef COMFORT_BENCH_H
+#define COMFORT_BENCH_H
+
+// Times the comfort metric lookup tables against libm on the device, in CPU cycles,
+// and prints the results to serial. Build the comfort-bench environment to run it at boot.
+// Only compiled with -DCOMFORT_BENCH.
+
+#ifdef COMFORT_BENCH
+void RunComfortBench();
+#endif
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef ENV_UNITS_H
+#define ENV_UNITS_H
+
+#include <stdint.h>
+
+#include <ComfortMetrics.h>
+#include <M5UnitENV.h>
+#include <PowerGovernor.h>
+#include <Recording.h>
+
+// ENV units, either directly on the bus or behind PaHub/TCA9548A I2C multiplexers.
+// If any hub is found, units are only looked for behind it, as a unit on the
+// main bus would clash with every unit downstream.
+
+// Hubs are looked for at consecutive addresses starting here
+#define PAHUB_I2C_ADDR 0x70
+
+#ifndef PAHUB_MAX_COUNT
+    #define PAHUB_MAX_COUNT 2
+#endif
+
+// 6 on the PaHub, 8 on a bare TCA9548A
+#ifndef PAHUB_CHANNEL_COUNT
+    #define PAHUB_CHANNEL_COUNT 6
+#endif
+
+#define MAX_ENV_UNITS (PAHUB_MAX_COUNT * PAHUB_CHANNEL_COUNT)
+
+// Loops between checks of empty channels for newly plugged units
+#define ENV_DISCOVERY_INTERVAL_LOOPS 30
+
+#define ENV_UNIT_DIRECT 0xFF
+
+struct EnvUnit {
+    // Hub address, or ENV_UNIT_DIRECT for the main bus
+    uint8_t hubAddress;
+    uint8_t hubChannel;
+    // Numbered across hubs, 0 for a unit on the main bus. Alert rules match on this.
+    uint8_t channel;
+    // Published as the channel tag; "bus" for a unit on the main bus
+    char label[8];
+
+    SHT4X sht4;
+    BMP280 bmp;
+    SCD4X scd4;
+
+    bool isSht4xInitialised;
+    bool isBmp280Initialised;
+    bool isScd4xInitialised;
+
+    ComfortMetrics comfortMetrics;
+
+    // Time taken to read every sensor on the unit in the last loop
+    uint32_t readMicros;
+
+    // Set when the hub couldn't be switched to the unit in the last update, so its
+    // sensors hold readings from an earlier loop
+    bool isSelectFailed;
+};
+
+void BeginEnvUnits(uint8_t sdaPin, uint8_t sclPin);
+
+// Reads every unit, one hub channel switch per unit
+void UpdateEnvUnits();
+
+int GetEnvUnitCount();
+
+EnvUnit& GetEnvUnit(int index);
+
+// The first unit with any sensor initialised, for the display and history.
+// nullptr if there isn't one.
+EnvUnit* GetPrimaryEnvUnit();
+
+bool HasAnySensorInitialised(const EnvUnit& unit);
+
+// Time taken by the last UpdateEnvUnits call
+uint32_t GetEnvUnitsReadMicros();
+
+// Applied to every SHT4x and BMP280 now and as they are found.
+// Lower precision reads faster and lets the BMP280 sample less often.
+void SetEnvUnitsPrecision(SensorPrecision precision);
+
+// For capture: the SHT4x at high precision and the BMP280 unfiltered, at its highest
+// oversampling with the shortest standby. Turning it off restores the set precision.
+void SetEnvUnitsCaptureSampling(bool isCapturing);
+
+// Reads one sensor on a unit, for capture. A failed read is returned rather than
+// dropping the sensor, and nothing is printed.
+// Returns false if the sensor didn't acknowledge or its data failed the CRC.
+bool ReadEnvUnitSensor(int index, RecordingSensor sensor);
+
+#endif
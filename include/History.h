@@ -0,0 +1,87 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+
+#include <TimeSeriesCodec.h>
+
+// Compressed sensor history.
+// Samples are appended to an in-RAM chunk. Full chunks are queued in RAM
+// and written to LittleFS in batches to limit flash wear.
+
+#define HISTORY_DIRECTORY "/history"
+
+// Number of sealed chunks kept in RAM before they are written to flash
+#define HISTORY_RAM_CHUNKS 2
+
+// Oldest files are deleted beyond this. 2KB each.
+#define HISTORY_MAX_FILES 384
+
+class HistoryQuery;
+
+class HistoryStore {
+public:
+    HistoryStore();
+
+    // Mounts LittleFS and finds any chunks left by a previous boot
+    bool Begin();
+
+    void Append(const HistorySample& sample);
+
+    // Writes the queued chunks to flash.
+    // Also writes the partially filled chunk if includeActive is set.
+    void Flush(bool includeActive);
+
+    uint32_t FirstSequence() const { return firstSequence; }
+    uint32_t NextSequence() const { return nextSequence; }
+
+private:
+    friend class HistoryQuery;
+
+    bool WriteChunk(const HistoryChunkHeader& header, const uint8_t* data);
+    void DeleteOldestChunk();
+
+    bool isMounted;
+
+    uint8_t activeBuffer[HISTORY_CHUNK_BYTES];
+    HistoryChunkEncoder activeChunk;
+
+    HistoryChunkHeader ramHeaders[HISTORY_RAM_CHUNKS];
+    uint8_t ramBuffers[HISTORY_RAM_CHUNKS][HISTORY_CHUNK_BYTES];
+    int ramChunkCount;
+
+    // Files are named by sequence number, so they are already in time order
+    uint32_t firstSequence;
+    uint32_t nextSequence;
+
+    // The newest timestamp stored anywhere, kept across chunks so every chunk starts after
+    // the one before, which HistoryQuery relies on. 0 before anything is stored.
+    uint32_t lastTimestamp;
+};
+
+// Iterates the stored samples with timestamps in [from, to] in time order.
+// Chunks which do not overlap the range are skipped using their headers alone.
+class HistoryQuery {
+public:
+    HistoryQuery(HistoryStore& store, uint32_t from, uint32_t to);
+
+    bool Next(HistorySample& sample);
+
+private:
+    bool LoadNextChunk();
+
+    HistoryStore& store;
+    uint32_t from;
+    uint32_t to;
+
+    // Walks the flash files, then the RAM queue, then the active chunk
+    uint32_t nextFileSequence;
+    int nextRamChunk;
+    bool hasReadActiveChunk;
+
+    HistoryChunkHeader header;
+    uint8_t buffer[HISTORY_CHUNK_BYTES];
+    HistoryChunkDecoder decoder;
+};
+
+#endif
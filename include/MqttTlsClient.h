@@ -0,0 +1,121 @@
+#ifndef MQTT_TLS_CLIENT_H
+#define MQTT_TLS_CLIENT_H
+
+#include <stdint.h>
+
+#include <Client.h>
+#include <WiFiClient.h>
+
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/x509_crt.h>
+
+// TLS over a WiFiClient, for PubSubClient.
+// Unlike WiFiClientSecure it keeps the TLS session between connections, so a reconnect
+// resumes it (by session ticket, or session ID if the broker doesn't issue tickets)
+// instead of repeating the certificate exchange and key agreement.
+// The session is also kept in RTC memory, which survives deep sleep but not a reset or power
+// loss. The firmware only deep sleeps when turned off with the power button, so this only
+// saves the handshake when it is turned back on.
+// The CA chain and random generator are set up once rather than on every connect.
+
+// For the handshake, and for each write
+#define MQTT_TLS_TIMEOUT_MS 10000
+
+// Asks the broker to keep its records within this size (the max_fragment_length extension).
+// mbedTLS's record buffers are fixed by the framework's build, at 16KB in and 4KB out for
+// the Arduino core; with CONFIG_MBEDTLS_DYNAMIC_BUFFER or a smaller SSL_IN_CONTENT_LEN
+// this keeps the broker within them.
+#define MQTT_TLS_MAX_FRAGMENT_LENGTH MBEDTLS_SSL_MAX_FRAG_LEN_2048
+
+// Room for the serialised session in RTC memory. It holds the broker's certificate, so
+// a session which doesn't fit is only kept in RAM.
+#define MQTT_TLS_RTC_SESSION_BYTES 2048
+
+// Until the clock is set from the RTC or NTP it reads 1970, and certificate validity dates
+// can't be checked, so connect refuses before this time
+#define MQTT_TLS_MIN_VALID_TIME 1704067200 // 2024-01-01
+
+struct TlsHandshakeStats {
+    uint32_t count;
+    uint32_t lastMicros;
+    uint64_t totalMicros;
+    // Heap held by the connection once the handshake has finished
+    int32_t lastHeapBytes;
+    // Lowest free heap seen during the last handshake
+    uint32_t lastMinFreeHeap;
+};
+
+struct TlsStats {
+    TlsHandshakeStats full;
+    TlsHandshakeStats resumed;
+    uint32_t failures;
+    // Last mbedTLS error code, 0 if none
+    int lastError;
+};
+
+class MqttTlsClient : public Client {
+public:
+    explicit MqttTlsClient(WiFiClient& transport);
+
+    // caCert is PEM and must outlive the client
+    bool Begin(const char* caCert);
+
+    // Whether the clock is set, so certificate dates can be checked
+    static bool IsClockValid();
+
+    // Always fails: the certificate is verified against the host name, which an address doesn't give
+    int connect(IPAddress ip, uint16_t port) override;
+    // Fails until the clock reads at least MQTT_TLS_MIN_VALID_TIME
+    int connect(const char* host, uint16_t port) override;
+    size_t write(uint8_t value) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+    int available() override;
+    int read() override;
+    int read(uint8_t* buffer, size_t size) override;
+    int peek() override;
+    void flush() override;
+    void stop() override;
+    uint8_t connected() override;
+    operator bool() override { return connected(); }
+
+    const TlsStats& GetStats() const { return stats; }
+
+    // Forces a full handshake on the next connect
+    void ClearSession();
+
+private:
+    static int SendToTransport(void* context, const unsigned char* buffer, size_t length);
+    static int ReceiveFromTransport(void* context, unsigned char* buffer, size_t length);
+    static int VerifyCertificate(void* context, mbedtls_x509_crt* certificate, int depth, uint32_t* flags);
+
+    bool Handshake(const char* host);
+    void SaveSession();
+    bool LoadSession();
+    void OnError(const char* operation, int error);
+
+    WiFiClient& transport;
+
+    bool isBegun;
+    bool isConnected;
+
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context random;
+    mbedtls_x509_crt caChain;
+    mbedtls_ssl_config config;
+    mbedtls_ssl_context ssl;
+
+    bool hasSession;
+    mbedtls_ssl_session session;
+
+    // Set by VerifyCertificate, which is only called in a full handshake
+    bool hasVerifiedCertificate;
+    uint32_t handshakeMinFreeHeap;
+
+    int peekedByte;
+
+    TlsStats stats;
+};
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <stdint.h>
+
+#include <PubSubClient.h>
+#include <Recording.h>
+
+// Captures a recording (see lib/Recording) to LittleFS for replay on the host.
+// Records are buffered in RAM and appended to the file in blocks.
+
+#define RECORDING_PATH "/recording.bin"
+
+// Recording stops by itself once the file reaches this size
+#define RECORDING_MAX_BYTES (512 * 1024)
+
+// Replaces any previous recording
+void StartRecording();
+
+void StopRecording();
+
+bool IsRecording();
+
+void RecordLoop();
+
+void RecordSensorReadings(uint8_t unit, const float values[RECORDING_FIELD_COUNT]);
+
+void RecordI2cError(uint8_t unit, RecordingSensor sensor);
+
+// sensorMask has a bit per initialised RecordingSensor
+void RecordUnitState(uint8_t unit, uint8_t channel, uint8_t sensorMask);
+
+void RecordLinkState(RecordingLink link, int8_t state);
+
+void RecordPublish(uint8_t decision, bool isSent);
+
+// Hex, 32 bytes per line, for pasting into tools/replay
+void DumpRecordingToSerial();
+
+// Publishes the raw recording to the given topic
+bool SendRecordingToMqtt(PubSubClient& client, const char* topic);
+
+#endif
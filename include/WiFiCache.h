@@ -0,0 +1,48 @@
+#ifndef WIFI_CACHE_H
+#define WIFI_CACHE_H
+
+#include <stdint.h>
+
+// Access point and DHCP lease from the last successful connection, kept in NVS.
+// Passing these to WiFi.begin/WiFi.config skips the channel scan and DHCP exchange.
+// The lease is only reused until its renewal time (half the lease), after which the
+// cached access point is still used but the address comes from DHCP.
+
+// Before NTP, or the RTC, has set the clock it reads 1970 and no lease can be trusted
+#define WIFI_CACHE_MIN_VALID_TIME 1704067200 // 2024-01-01
+
+// How long to wait for the gateway to answer an ARP request
+#define WIFI_GATEWAY_ARP_TIMEOUT_MS 1000
+
+struct WiFiCache {
+    bool isValid;
+    uint8_t bssid[6];
+    int32_t channel;
+    uint32_t localIp;
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns;
+    // Unix time at which a DHCP client would renew the lease, 0 if unknown
+    uint32_t leaseRenewAt;
+};
+
+bool LoadWiFiCache(WiFiCache& cache);
+
+// Whether the cached lease can still be used in place of DHCP
+bool IsWiFiCacheLeaseValid(const WiFiCache& cache);
+
+// Only writes to flash if the details have changed
+void SaveWiFiCache(const WiFiCache& cache);
+
+void ClearWiFiCache();
+
+// The lease time given by the DHCP server for the current connection, 0 if the address
+// wasn't given by DHCP
+uint32_t GetDhcpLeaseSeconds();
+
+// Whether the gateway answers an ARP request, i.e. the link and address work.
+// Used to tell a stale lease from a broker which is down or refusing the connection.
+// Blocks for up to WIFI_GATEWAY_ARP_TIMEOUT_MS.
+bool IsGatewayReachable(uint32_t gateway);
+
+#endif
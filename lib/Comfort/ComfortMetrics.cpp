@@ -0,0 +1,178 @@
+#include "ComfortMetrics.h"
+
+#include <array>
+#include <math.h>
+
+// Table entries per octave. Interpolation error is bounded by (1/N)^2 / 8.
+#define COMFORT_TABLE_SIZE 256
+
+#define LN2 0.69314718055994530942
+#define LOG2E 1.44269504088896340736
+
+// ========
+// Compile time table generation
+// ========
+
+// ln(m) = 2 * atanh((m - 1) / (m + 1)), which converges quickly for m in [1, 2]
+constexpr double ConstexprLog(double m) {
+    double z = (m - 1.0) / (m + 1.0);
+    double zSquared = z * z;
+    double term = z;
+    double sum = 0.0;
+
+    for (int k = 0; k < 30; k++) {
+        sum += term / (2 * k + 1);
+        term *= zSquared;
+    }
+
+    return 2.0 * sum;
+}
+
+// 2^f for f in [0, 1] by Taylor series of e^(f ln2)
+constexpr double ConstexprExp2(double f) {
+    double x = f * LN2;
+    double term = 1.0;
+    double sum = 1.0;
+
+    for (int k = 1; k < 30; k++) {
+        term *= x / k;
+        sum += term;
+    }
+
+    return sum;
+}
+
+constexpr std::array<float, COMFORT_TABLE_SIZE + 1> logMantissaTable = [] {
+    std::array<float, COMFORT_TABLE_SIZE + 1> table {};
+    for (int i = 0; i <= COMFORT_TABLE_SIZE; i++) {
+        table[i] = (float)ConstexprLog(1.0 + (double)i / COMFORT_TABLE_SIZE);
+    }
+    return table;
+}();
+
+constexpr std::array<float, COMFORT_TABLE_SIZE + 1> exp2FractionTable = [] {
+    std::array<float, COMFORT_TABLE_SIZE + 1> table {};
+    for (int i = 0; i <= COMFORT_TABLE_SIZE; i++) {
+        table[i] = (float)ConstexprExp2((double)i / COMFORT_TABLE_SIZE);
+    }
+    return table;
+}();
+
+static_assert(logMantissaTable[0] == 0.0f, "ln(1) must be exact");
+static_assert(logMantissaTable[COMFORT_TABLE_SIZE] > 0.693147f
+    && logMantissaTable[COMFORT_TABLE_SIZE] < 0.693148f, "ln(2) out of tolerance");
+static_assert(exp2FractionTable[0] == 1.0f, "2^0 must be exact");
+static_assert(exp2FractionTable[COMFORT_TABLE_SIZE] > 1.999999f
+    && exp2FractionTable[COMFORT_TABLE_SIZE] < 2.000001f, "2^1 out of tolerance");
+
+// ========
+// Approximations
+// ========
+
+float FastLog(float x) {
+    if (!(x > 0.0f)) {
+        return x == 0.0f ? -INFINITY : NAN;
+    }
+
+    // x = mantissa * 2^exponent, mantissa in [0.5, 1)
+    int exponent;
+    float mantissa = frexpf(x, &exponent) * 2.0f;
+    exponent--;
+
+    float position = (mantissa - 1.0f) * COMFORT_TABLE_SIZE;
+    int index = (int)position;
+    if (index >= COMFORT_TABLE_SIZE) index = COMFORT_TABLE_SIZE - 1;
+    float fraction = position - index;
+
+    float logMantissa = logMantissaTable[index]
+        + (logMantissaTable[index + 1] - logMantissaTable[index]) * fraction;
+
+    return logMantissa + exponent * (float)LN2;
+}
+
+float FastExp(float x) {
+    if (isnan(x)) {
+        return x;
+    }
+
+    // e^x = 2^(x log2 e) = 2^whole * 2^fraction
+    float power = x * (float)LOG2E;
+    if (power > 128.0f) return INFINITY;
+    if (power < -150.0f) return 0.0f;
+
+    float whole = floorf(power);
+    float position = (power - whole) * COMFORT_TABLE_SIZE;
+    int index = (int)position;
+    if (index >= COMFORT_TABLE_SIZE) index = COMFORT_TABLE_SIZE - 1;
+    float fraction = position - index;
+
+    float exp2Fraction = exp2FractionTable[index]
+        + (exp2FractionTable[index + 1] - exp2FractionTable[index]) * fraction;
+
+    return ldexpf(exp2Fraction, (int)whole);
+}
+
+float FastPow(float base, float exponent) {
+    return FastExp(exponent * FastLog(base));
+}
+
+// ========
+// Metrics
+// ========
+
+// Magnus coefficients over water (Sonntag 1990)
+#define MAGNUS_A 17.62f
+#define MAGNUS_B 243.12f
+#define MAGNUS_C 6.112f
+
+float CalculateDewPoint(float temperature, float relativeHumidity) {
+    if (!(relativeHumidity > 0.0f)) {
+        return NAN;
+    }
+
+    float gamma = FastLog(relativeHumidity / 100.0f) + (MAGNUS_A * temperature) / (MAGNUS_B + temperature);
+
+    return (MAGNUS_B * gamma) / (MAGNUS_A - gamma);
+}
+
+float CalculateAbsoluteHumidity(float temperature, float relativeHumidity) {
+    // Saturation vapour pressure in hPa
+    float saturationPressure = MAGNUS_C * FastExp((MAGNUS_A * temperature) / (MAGNUS_B + temperature));
+
+    // 216.679 = 100 Pa/hPa * 1000 g/kg / 461.5 J/(kg K), the gas constant of water vapour
+    return 216.679f * (saturationPressure * relativeHumidity / 100.0f) / (273.15f + temperature);
+}
+
+float CalculateHeatIndex(float temperature, float relativeHumidity) {
+    float t = temperature * 1.8f + 32.0f;
+    float rh = relativeHumidity;
+
+    // Steadman's simple formula is used below 80F
+    float heatIndex = 0.5f * (t + 61.0f + ((t - 68.0f) * 1.2f) + (rh * 0.094f));
+
+    if ((heatIndex + t) / 2.0f >= 80.0f) {
+        heatIndex = -42.379f
+            + 2.04901523f * t
+            + 10.14333127f * rh
+            - 0.22475541f * t * rh
+            - 0.00683783f * t * t
+            - 0.05481717f * rh * rh
+            + 0.00122874f * t * t * rh
+            + 0.00085282f * t * rh * rh
+            - 0.00000199f * t * t * rh * rh;
+
+        if (rh < 13.0f && t >= 80.0f && t <= 112.0f) {
+            heatIndex -= ((13.0f - rh) / 4.0f) * sqrtf((17.0f - fabsf(t - 95.0f)) / 17.0f);
+        } else if (rh > 85.0f && t >= 80.0f && t <= 87.0f) {
+            heatIndex += ((rh - 85.0f) / 10.0f) * ((87.0f - t) / 5.0f);
+        }
+    }
+
+    return (heatIndex - 32.0f) / 1.8f;
+}
+
+float CalculateSeaLevelPressure(float pressure, float temperature, float altitude) {
+    float lapse = 0.0065f * altitude;
+
+    return pressure * FastPow(1.0f - lapse / (temperature + lapse + 273.15f), -5.257f);
+}
@@ -0,0 +1,37 @@
+#ifndef COMFORT_METRICS_H
+#define COMFORT_METRICS_H
+
+// Quantities derived from the raw temperature, humidity and pressure readings.
+// log/exp/pow are replaced by table lookups with linear interpolation.
+// The tables are generated at compile time. FastLog is within 3e-6 absolute and
+// FastExp within 5e-6 relative of the libm results, well under the sensors' own accuracy.
+// tools/comfort_check sweeps both, and each metric, against libm and checks these bounds.
+// On the host libm is faster; the comfort-bench environment compares the cycle counts on the device.
+
+struct ComfortMetrics {
+    // C
+    float dewPoint;
+    // g/m3
+    float absoluteHumidity;
+    // C
+    float heatIndex;
+    // Pa
+    float seaLevelPressure;
+};
+
+float FastLog(float x);
+float FastExp(float x);
+float FastPow(float base, float exponent);
+
+// Magnus formula
+float CalculateDewPoint(float temperature, float relativeHumidity);
+
+float CalculateAbsoluteHumidity(float temperature, float relativeHumidity);
+
+// NOAA heat index (Rothfusz regression with the NWS adjustments)
+float CalculateHeatIndex(float temperature, float relativeHumidity);
+
+// Barometric formula, altitude in metres
+float CalculateSeaLevelPressure(float pressure, float temperature, float altitude);
+
+#endif
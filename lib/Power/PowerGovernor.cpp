@@ -0,0 +1,145 @@
+#include "PowerGovernor.h"
+
+#include <Trace.h>
+
+// Weight of the latest window in the smoothed discharge rate
+#define POWER_RATE_SMOOTHING 0.5f
+
+static const PowerProfileSettings powerProfileSettings[POWER_PROFILE_COUNT] = {
+    // name, loop delay, publish interval, brightness, display timeout, sensor precision, WiFi power save
+    { "performance", 1000, 10, 200, 0, SENSOR_PRECISION_HIGH, WIFI_POWER_SAVE_NONE },
+    { "balanced", 2000, 15, 100, 60 * 1000, SENSOR_PRECISION_HIGH, WIFI_POWER_SAVE_MIN },
+    { "saver", 5000, 12, 60, 20 * 1000, SENSOR_PRECISION_MEDIUM, WIFI_POWER_SAVE_MAX },
+    { "critical", 10000, 30, 30, 5 * 1000, SENSOR_PRECISION_LOW, WIFI_POWER_SAVE_MAX },
+};
+
+const PowerProfileSettings& GetPowerProfileSettings(PowerProfile profile) {
+    return powerProfileSettings[profile];
+}
+
+PowerGovernor::PowerGovernor()
+    : profile(POWER_PROFILE_PERFORMANCE), profileChangedAt(0),
+      runtimeLimitedProfile(POWER_PROFILE_PERFORMANCE),
+      hasRateWindow(false), rateWindowStartMillis(0), rateWindowLevelSum(0), rateWindowSampleCount(0),
+      hasPreviousWindowLevel(false), previousWindowLevel(0.0f),
+      hasRate(false), rate(0.0f) {
+}
+
+const PowerProfileSettings& PowerGovernor::GetSettings() const {
+    return GetPowerProfileSettings(profile);
+}
+
+bool PowerGovernor::Update(uint32_t millis, const BatteryStatus& battery) {
+    TRACE_SCOPE("PowerGovernor::Update");
+
+    if (battery.level < 0 || (battery.isChargeKnown && battery.isCharging)) {
+        ResetDischargeRate();
+    } else {
+        UpdateDischargeRate(millis, battery.level);
+    }
+
+    // Without a charge state, a rising level is the only sign of external power
+    bool isExternallyPowered = battery.level < 0 || (battery.isChargeKnown
+        ? battery.isCharging
+        : hasRate && rate < -POWER_CHARGING_RATE);
+
+    PowerProfile target;
+    if (isExternallyPowered) {
+        runtimeLimitedProfile = POWER_PROFILE_PERFORMANCE;
+        target = POWER_PROFILE_PERFORMANCE;
+    } else {
+        UpdateRuntimeLimit(battery.level);
+
+        target = ChooseProfile(battery);
+        if (target < runtimeLimitedProfile) {
+            target = runtimeLimitedProfile;
+        }
+    }
+
+    if (target == profile) {
+        return false;
+    }
+
+    // Don't step back up on a brief recovery of the battery voltage
+    bool isSteppingUp = target < profile;
+    if (isSteppingUp && !isExternallyPowered && millis - profileChangedAt < POWER_MIN_PROFILE_MS) {
+        return false;
+    }
+
+    profile = target;
+    profileChangedAt = millis;
+
+    return true;
+}
+
+PowerProfile PowerGovernor::ChooseProfile(const BatteryStatus& battery) const {
+    int balancedMinPercent = POWER_BALANCED_MIN_PERCENT;
+    if (profile > POWER_PROFILE_BALANCED) {
+        balancedMinPercent += POWER_HYSTERESIS_PERCENT;
+    }
+
+    int saverMinPercent = POWER_SAVER_MIN_PERCENT;
+    if (profile > POWER_PROFILE_SAVER) {
+        saverMinPercent += POWER_HYSTERESIS_PERCENT;
+    }
+
+    if (battery.level >= balancedMinPercent) {
+        return POWER_PROFILE_BALANCED;
+    }
+
+    if (battery.level >= saverMinPercent) {
+        return POWER_PROFILE_SAVER;
+    }
+
+    return POWER_PROFILE_CRITICAL;
+}
+
+// Draining faster than the level alone suggests
+void PowerGovernor::UpdateRuntimeLimit(int level) {
+    if (!hasRate || rate <= 0.0f || level / rate >= POWER_LOW_RUNTIME_HOURS) {
+        return;
+    }
+
+    if (profile != POWER_PROFILE_CRITICAL && runtimeLimitedProfile <= profile) {
+        runtimeLimitedProfile = (PowerProfile)(profile + 1);
+
+        // The next step down needs a fresh measurement at the new draw
+        hasRate = false;
+    }
+}
+
+void PowerGovernor::UpdateDischargeRate(uint32_t millis, int level) {
+    if (!hasRateWindow) {
+        hasRateWindow = true;
+        rateWindowStartMillis = millis;
+        rateWindowLevelSum = 0;
+        rateWindowSampleCount = 0;
+    }
+
+    rateWindowLevelSum += level;
+    rateWindowSampleCount++;
+
+    uint32_t elapsedMillis = millis - rateWindowStartMillis;
+    if (elapsedMillis < POWER_RATE_WINDOW_MS) {
+        return;
+    }
+
+    float windowLevel = (float)rateWindowLevelSum / rateWindowSampleCount;
+
+    if (hasPreviousWindowLevel) {
+        float windowRate = (previousWindowLevel - windowLevel) * (3600.0f * 1000.0f) / elapsedMillis;
+        rate = hasRate ? rate + (windowRate - rate) * POWER_RATE_SMOOTHING : windowRate;
+        hasRate = true;
+    }
+
+    hasPreviousWindowLevel = true;
+    previousWindowLevel = windowLevel;
+    hasRateWindow = false;
+}
+
+void PowerGovernor::ResetDischargeRate() {
+    hasRateWindow = false;
+    hasPreviousWindowLevel = false;
+    hasRate = false;
+    rate = 0.0f;
+}
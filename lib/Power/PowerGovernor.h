@@ -0,0 +1,119 @@
+#ifndef POWER_GOVERNOR_H
+#define POWER_GOVERNOR_H
+
+#include <stdint.h>
+
+// Chooses an operating profile from the battery level, charge state and discharge rate.
+// Kept free of Arduino dependencies so the policy can be run against a simulated
+// battery on the host, see tools/power_sim.
+
+// Battery levels below which the balanced and saver profiles are left
+#define POWER_BALANCED_MIN_PERCENT 50
+#define POWER_SAVER_MIN_PERCENT 15
+
+// A profile is only returned to once the level is this far above its threshold,
+// as the level read from the battery voltage jumps around under WiFi load
+#define POWER_HYSTERESIS_PERCENT 5
+
+// Step down a profile if the battery is projected to run out within this time.
+// The governor doesn't step back up from this until the battery is charged, as the
+// lower profile's lower draw would otherwise lift the projection straight back.
+#define POWER_LOW_RUNTIME_HOURS 2
+
+// The discharge rate is taken between the average levels of consecutive windows of this length,
+// which evens out the 1% steps and the noise of the level reading
+#define POWER_RATE_WINDOW_MS (10 * 60 * 1000UL)
+
+// Without a charge state, a level rising faster than this is taken as charging (percent per hour)
+#define POWER_CHARGING_RATE 5.0f
+
+// Minimum time in a profile before stepping up to a more demanding one.
+// Stepping down is always immediate.
+#define POWER_MIN_PROFILE_MS (5 * 60 * 1000UL)
+
+enum PowerProfile {
+    // Charging or on external power
+    POWER_PROFILE_PERFORMANCE = 0,
+    POWER_PROFILE_BALANCED,
+    POWER_PROFILE_SAVER,
+    POWER_PROFILE_CRITICAL,
+    POWER_PROFILE_COUNT,
+};
+
+enum SensorPrecision {
+    SENSOR_PRECISION_HIGH = 0,
+    SENSOR_PRECISION_MEDIUM,
+    SENSOR_PRECISION_LOW,
+};
+
+enum WifiPowerSave {
+    WIFI_POWER_SAVE_NONE = 0,
+    WIFI_POWER_SAVE_MIN,
+    WIFI_POWER_SAVE_MAX,
+};
+
+struct PowerProfileSettings {
+    const char* name;
+
+    // Delay between loops, so between sensor samples
+    uint32_t loopDelayMillis;
+    uint32_t publishIntervalLoops;
+
+    // 0-255
+    uint8_t displayBrightness;
+    // The display is turned off after this long without a button press, 0 to keep it on
+    uint32_t displayTimeoutMillis;
+
+    SensorPrecision sensorPrecision;
+    WifiPowerSave wifiPowerSave;
+};
+
+struct BatteryStatus {
+    // 0-100, negative if there is no battery to read
+    int level;
+    bool isCharging;
+    // Some boards can't tell whether they are charging
+    bool isChargeKnown;
+};
+
+class PowerGovernor {
+public:
+    PowerGovernor();
+
+    // Call once per loop. Returns true if the profile changed.
+    bool Update(uint32_t millis, const BatteryStatus& battery);
+
+    PowerProfile GetProfile() const { return profile; }
+    const PowerProfileSettings& GetSettings() const;
+
+    bool HasDischargeRate() const { return hasRate; }
+    // Percent per hour, negative while the level is rising
+    float GetDischargeRate() const { return rate; }
+
+private:
+    PowerProfile ChooseProfile(const BatteryStatus& battery) const;
+    void UpdateRuntimeLimit(int level);
+    void UpdateDischargeRate(uint32_t millis, int level);
+    void ResetDischargeRate();
+
+    PowerProfile profile;
+    uint32_t profileChangedAt;
+
+    // The least demanding profile chosen for a short projected runtime since the last charge
+    PowerProfile runtimeLimitedProfile;
+
+    bool hasRateWindow;
+    uint32_t rateWindowStartMillis;
+    uint32_t rateWindowLevelSum;
+    uint32_t rateWindowSampleCount;
+
+    bool hasPreviousWindowLevel;
+    float previousWindowLevel;
+
+    bool hasRate;
+    float rate;
+};
+
+const PowerProfileSettings& GetPowerProfileSettings(PowerProfile profile);
+
+#endif
@@ -0,0 +1,14 @@
+#include "ConnectPacer.h"
+
+ConnectPacer::ConnectPacer() : hasAttempted(false), lastAttemptMillis(0), failureCount(0) {
+}
+
+bool ConnectPacer::IsDue(uint32_t millis) const {
+    return !hasAttempted || millis - lastAttemptMillis >= CONNECT_RETRY_INTERVAL_MS;
+}
+
+void ConnectPacer::OnAttempt(uint32_t millis, bool isConnected) {
+    hasAttempted = true;
+    lastAttemptMillis = millis;
+    failureCount = isConnected ? 0 : failureCount + 1;
+}
@@ -0,0 +1,31 @@
+#ifndef CONNECT_PACER_H
+#define CONNECT_PACER_H
+
+#include <stdint.h>
+
+// Spaces out attempts to connect to the broker, so a loop running faster than this
+// (as it does while booting) doesn't retry one which is down, or a full TLS handshake,
+// on every pass. Kept free of Arduino dependencies so the replay tool runs the same decisions.
+
+// Once a second, as the loop ran before the boot loop delay was shortened
+#define CONNECT_RETRY_INTERVAL_MS 1000
+
+class ConnectPacer {
+public:
+    ConnectPacer();
+
+    // Whether an attempt may start at this time
+    bool IsDue(uint32_t millis) const;
+
+    void OnAttempt(uint32_t millis, bool isConnected);
+
+    // Failed attempts since the last success
+    uint32_t GetFailureCount() const { return failureCount; }
+
+private:
+    bool hasAttempted;
+    uint32_t lastAttemptMillis;
+    uint32_t failureCount;
+};
+
+#endif
@@ -0,0 +1,53 @@
+#include "PublishScheduler.h"
+
+#include <Trace.h>
+
+PublishScheduler::PublishScheduler() : isBooting(true), intervalLoops(PUBLISH_INTERVAL_LOOPS), loopsSincePublish(0) {
+}
+
+PublishDecision PublishScheduler::OnLoop(const LinkStatus& link, bool hasSensorData) {
+    TRACE_SCOPE("PublishScheduler::OnLoop");
+
+    loopsSincePublish++;
+
+    bool isReady = link.isMqttConnected && link.hasRtcSynced;
+    bool isDue = loopsSincePublish >= intervalLoops || (isBooting && isReady);
+
+    if (!isDue) {
+        return PUBLISH_NOT_DUE;
+    }
+
+    loopsSincePublish = 0;
+
+    if (!link.isMqttConnected) {
+        return PUBLISH_REFUSED_DISCONNECTED;
+    }
+
+    if (!link.hasRtcSynced) {
+        return PUBLISH_REFUSED_NOT_SYNCED;
+    }
+
+    if (!hasSensorData) {
+        return PUBLISH_REFUSED_NO_DATA;
+    }
+
+    return PUBLISH_SEND;
+}
+
+void PublishScheduler::OnPublishResult(bool isSent) {
+    if (isSent) {
+        isBooting = false;
+    }
+}
+
+const char* GetPublishDecisionName(PublishDecision decision) {
+    switch (decision) {
+        case PUBLISH_NOT_DUE: return "notDue";
+        case PUBLISH_SEND: return "send";
+        case PUBLISH_REFUSED_DISCONNECTED: return "refusedDisconnected";
+        case PUBLISH_REFUSED_NOT_SYNCED: return "refusedNotSynced";
+        case PUBLISH_REFUSED_NO_DATA: return "refusedNoData";
+    }
+
+    return "unknown";
+}
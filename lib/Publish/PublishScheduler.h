@@ -0,0 +1,52 @@
+#ifndef PUBLISH_SCHEDULER_H
+#define PUBLISH_SCHEDULER_H
+
+#include <stdint.h>
+
+// Decides on each loop whether the sensor payload should be published.
+// Kept free of Arduino dependencies so the replay tool runs the same decisions.
+
+// Default interval; the power profile may change it
+#define PUBLISH_INTERVAL_LOOPS 10
+
+struct LinkStatus {
+    bool isWifiConnected;
+    bool isWifiClientConnected;
+    bool isMqttConnected;
+    bool hasRtcSynced;
+};
+
+enum PublishDecision {
+    PUBLISH_NOT_DUE = 0,
+    PUBLISH_SEND,
+    PUBLISH_REFUSED_DISCONNECTED,
+    PUBLISH_REFUSED_NOT_SYNCED,
+    PUBLISH_REFUSED_NO_DATA,
+};
+
+class PublishScheduler {
+public:
+    PublishScheduler();
+
+    // Call once per loop.
+    // The first payload is sent as soon as the link is ready, then every interval.
+    PublishDecision OnLoop(const LinkStatus& link, bool hasSensorData);
+
+    void OnPublishResult(bool isSent);
+
+    void SetIntervalLoops(uint32_t loops) { intervalLoops = loops; }
+
+    // True until the first payload has been sent
+    bool IsBooting() const { return isBooting; }
+
+    uint32_t GetLoopsSincePublish() const { return loopsSincePublish; }
+
+private:
+    bool isBooting;
+    uint32_t intervalLoops;
+    uint32_t loopsSincePublish;
+};
+
+const char* GetPublishDecisionName(PublishDecision decision);
+
+#endif
@@ -0,0 +1,291 @@
+#include "Recording.h"
+
+#include <math.h>
+#include <string.h>
+
+// ========
+// Writer
+// ========
+
+RecordingWriter::RecordingWriter() : sink(nullptr), context(nullptr), lastMillis(0), bytesWritten(0) {
+}
+
+void RecordingWriter::Begin(RecordingSink sink, void* context, uint32_t millis) {
+    this->sink = sink;
+    this->context = context;
+    lastMillis = millis;
+    bytesWritten = 0;
+
+    for (int i = 0; i < RECORDING_MAX_UNITS; i++) {
+        hasLastValues[i] = false;
+        hasLastUnitStates[i] = false;
+    }
+    for (int i = 0; i < RECORDING_LINK_COUNT; i++) {
+        hasLastLinkStates[i] = false;
+    }
+
+    uint8_t header[RECORDING_HEADER_BYTES];
+    memcpy(header, RECORDING_MAGIC, 4);
+    header[4] = RECORDING_VERSION;
+    header[5] = 0;
+    WriteBytes(header, sizeof(header));
+
+    // The start time, so the reader's clock matches the device's millis()
+    WriteVarint(millis);
+}
+
+void RecordingWriter::WriteLoop(uint32_t millis) {
+    WriteRecordStart(RECORD_LOOP, millis);
+}
+
+void RecordingWriter::WriteSensorReadings(uint32_t millis, uint8_t unit, const float values[RECORDING_FIELD_COUNT]) {
+    if (unit >= RECORDING_MAX_UNITS) {
+        return;
+    }
+
+    uint32_t bits[RECORDING_FIELD_COUNT];
+    uint8_t changedMask = 0;
+
+    for (int i = 0; i < RECORDING_FIELD_COUNT; i++) {
+        memcpy(&bits[i], &values[i], sizeof(bits[i]));
+
+        if (!hasLastValues[unit] || bits[i] != lastValues[unit][i]) {
+            changedMask |= 1 << i;
+            lastValues[unit][i] = bits[i];
+        }
+    }
+    hasLastValues[unit] = true;
+
+    if (changedMask == 0) {
+        return;
+    }
+
+    WriteRecordStart(RECORD_SENSOR_READINGS, millis);
+    WriteBytes(&unit, 1);
+    WriteBytes(&changedMask, 1);
+
+    for (int i = 0; i < RECORDING_FIELD_COUNT; i++) {
+        if (changedMask & (1 << i)) {
+            // Little endian regardless of host
+            uint8_t bytes[4] = {
+                (uint8_t)bits[i], (uint8_t)(bits[i] >> 8), (uint8_t)(bits[i] >> 16), (uint8_t)(bits[i] >> 24)
+            };
+            WriteBytes(bytes, sizeof(bytes));
+        }
+    }
+}
+
+void RecordingWriter::WriteI2cError(uint32_t millis, uint8_t unit, RecordingSensor sensor) {
+    WriteRecordStart(RECORD_I2C_ERROR, millis);
+
+    uint8_t payload[2] = { unit, (uint8_t)sensor };
+    WriteBytes(payload, sizeof(payload));
+}
+
+void RecordingWriter::WriteUnitState(uint32_t millis, uint8_t unit, uint8_t channel, uint8_t sensorMask) {
+    if (unit >= RECORDING_MAX_UNITS) {
+        return;
+    }
+
+    if (hasLastUnitStates[unit] && lastChannels[unit] == channel && lastSensorMasks[unit] == sensorMask) {
+        return;
+    }
+
+    lastChannels[unit] = channel;
+    lastSensorMasks[unit] = sensorMask;
+    hasLastUnitStates[unit] = true;
+
+    WriteRecordStart(RECORD_UNIT_STATE, millis);
+
+    uint8_t payload[3] = { unit, channel, sensorMask };
+    WriteBytes(payload, sizeof(payload));
+}
+
+void RecordingWriter::WriteLinkState(uint32_t millis, RecordingLink link, int8_t state) {
+    if (hasLastLinkStates[link] && lastLinkStates[link] == state) {
+        return;
+    }
+
+    lastLinkStates[link] = state;
+    hasLastLinkStates[link] = true;
+
+    WriteRecordStart(RECORD_LINK_STATE, millis);
+
+    uint8_t payload[2] = { (uint8_t)link, (uint8_t)state };
+    WriteBytes(payload, sizeof(payload));
+}
+
+void RecordingWriter::WritePublish(uint32_t millis, uint8_t decision, bool isSent) {
+    WriteRecordStart(RECORD_PUBLISH, millis);
+
+    uint8_t payload[2] = { decision, (uint8_t)isSent };
+    WriteBytes(payload, sizeof(payload));
+}
+
+void RecordingWriter::WriteRecordStart(RecordType type, uint32_t millis) {
+    uint8_t typeByte = type;
+    WriteBytes(&typeByte, 1);
+
+    WriteVarint(millis - lastMillis);
+    lastMillis = millis;
+}
+
+void RecordingWriter::WriteVarint(uint32_t value) {
+    uint8_t bytes[5];
+    size_t length = 0;
+
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        bytes[length++] = byte | (value != 0 ? 0x80 : 0);
+    } while (value != 0);
+
+    WriteBytes(bytes, length);
+}
+
+void RecordingWriter::WriteBytes(const uint8_t* data, size_t length) {
+    if (sink == nullptr) {
+        return;
+    }
+
+    sink(data, length, context);
+    bytesWritten += length;
+}
+
+// ========
+// Reader
+// ========
+
+RecordingReader::RecordingReader(const uint8_t* data, size_t length)
+    : data(data), length(length), position(0), isValid(false), millis(0) {
+    for (int unit = 0; unit < RECORDING_MAX_UNITS; unit++) {
+        for (int i = 0; i < RECORDING_FIELD_COUNT; i++) {
+            unitValues[unit][i] = NAN;
+        }
+    }
+
+    if (length < RECORDING_HEADER_BYTES
+            || memcmp(data, RECORDING_MAGIC, 4) != 0
+            || data[4] != RECORDING_VERSION) {
+        return;
+    }
+
+    position = RECORDING_HEADER_BYTES;
+    isValid = ReadVarint(millis);
+}
+
+bool RecordingReader::Next(RecordingEvent& event) {
+    if (!isValid) {
+        return false;
+    }
+
+    uint8_t type;
+    uint32_t deltaMillis;
+    if (!ReadByte(type) || !ReadVarint(deltaMillis)) {
+        return false;
+    }
+
+    millis += deltaMillis;
+
+    event.type = (RecordType)type;
+    event.millis = millis;
+
+    uint8_t first;
+    uint8_t second;
+
+    switch (event.type) {
+        case RECORD_LOOP:
+            return true;
+
+        case RECORD_SENSOR_READINGS:
+            if (!ReadByte(first) || !ReadByte(second) || first >= RECORDING_MAX_UNITS) {
+                return false;
+            }
+
+            event.unit = first;
+            event.changedMask = second;
+
+            for (int i = 0; i < RECORDING_FIELD_COUNT; i++) {
+                if (event.changedMask & (1 << i)) {
+                    uint8_t bytes[4];
+                    for (int j = 0; j < 4; j++) {
+                        if (!ReadByte(bytes[j])) {
+                            return false;
+                        }
+                    }
+
+                    uint32_t bits = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+                    memcpy(&unitValues[event.unit][i], &bits, sizeof(bits));
+                }
+
+                event.values[i] = unitValues[event.unit][i];
+            }
+            return true;
+
+        case RECORD_I2C_ERROR:
+            if (!ReadByte(first) || !ReadByte(second)) {
+                return false;
+            }
+
+            event.unit = first;
+            event.sensor = (RecordingSensor)second;
+            return true;
+
+        case RECORD_LINK_STATE:
+            if (!ReadByte(first) || !ReadByte(second) || first >= RECORDING_LINK_COUNT) {
+                return false;
+            }
+
+            event.link = (RecordingLink)first;
+            event.state = (int8_t)second;
+            return true;
+
+        case RECORD_PUBLISH:
+            if (!ReadByte(first) || !ReadByte(second)) {
+                return false;
+            }
+
+            event.decision = first;
+            event.isSent = second != 0;
+            return true;
+
+        case RECORD_UNIT_STATE:
+            if (!ReadByte(first) || !ReadByte(second) || !ReadByte(event.sensorMask) || first >= RECORDING_MAX_UNITS) {
+                return false;
+            }
+
+            event.unit = first;
+            event.channel = second;
+            return true;
+    }
+
+    return false;
+}
+
+bool RecordingReader::ReadByte(uint8_t& value) {
+    if (position >= length) {
+        return false;
+    }
+
+    value = data[position++];
+    return true;
+}
+
+bool RecordingReader::ReadVarint(uint32_t& value) {
+    value = 0;
+
+    for (int shift = 0; shift < 35; shift += 7) {
+        uint8_t byte;
+        if (!ReadByte(byte)) {
+            return false;
+        }
+
+        value |= (uint32_t)(byte & 0x7F) << shift;
+
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,148 @@
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <TimeSeriesCodec.h>
+
+// Compact binary log of what the device saw: loop boundaries, each unit's channel and
+// initialised sensors, sensor readings, I2C errors, link state changes and publish outcomes.
+// Recorded on the device and replayed on the host by tools/replay.
+//
+// Layout: a 6 byte header ("TIRL", version, reserved) and the start millis() as a varint,
+// then records of type (1 byte), milliseconds since the previous record (varint), payload.
+// Sensor records only carry the fields which changed since the unit's last record.
+// Version 2 added the unit state record.
+
+#define RECORDING_MAGIC "TIRL"
+#define RECORDING_VERSION 2
+#define RECORDING_HEADER_BYTES 6
+
+// At least MAX_ENV_UNITS
+#define RECORDING_MAX_UNITS 16
+
+// Sensor values are in HistoryField order
+#define RECORDING_FIELD_COUNT HISTORY_FIELD_COUNT
+
+// Raw WiFi.status() and mqttClient.state() values, so the host needn't include their headers
+#define RECORDING_WIFI_STATE_CONNECTED 3
+#define RECORDING_MQTT_STATE_CONNECTED 0
+
+enum RecordType {
+    RECORD_LOOP = 1,
+    RECORD_SENSOR_READINGS,
+    RECORD_I2C_ERROR,
+    RECORD_LINK_STATE,
+    RECORD_PUBLISH,
+    RECORD_UNIT_STATE,
+};
+
+enum RecordingSensor {
+    RECORDING_SENSOR_SHT4X = 0,
+    RECORDING_SENSOR_BMP280,
+    RECORDING_SENSOR_SCD4X,
+};
+
+enum RecordingLink {
+    RECORDING_LINK_WIFI = 0,
+    RECORDING_LINK_WIFI_CLIENT,
+    RECORDING_LINK_MQTT,
+    RECORDING_LINK_NTP,
+    RECORDING_LINK_COUNT,
+};
+
+struct RecordingEvent {
+    RecordType type;
+    // Device millis() at the time of the record
+    uint32_t millis;
+
+    // RECORD_SENSOR_READINGS, RECORD_I2C_ERROR and RECORD_UNIT_STATE
+    uint8_t unit;
+    // RECORD_SENSOR_READINGS: all current values for the unit, NAN where absent
+    float values[RECORDING_FIELD_COUNT];
+    uint8_t changedMask;
+    // RECORD_I2C_ERROR
+    RecordingSensor sensor;
+
+    // RECORD_UNIT_STATE: the unit's channel, and a bit per initialised RecordingSensor
+    uint8_t channel;
+    uint8_t sensorMask;
+
+    // RECORD_LINK_STATE
+    RecordingLink link;
+    int8_t state;
+
+    // RECORD_PUBLISH: a PublishDecision, or PUBLISH_SEND for a send that failed with isSent false
+    uint8_t decision;
+    bool isSent;
+};
+
+typedef void (*RecordingSink)(const uint8_t* data, size_t length, void* context);
+
+class RecordingWriter {
+public:
+    RecordingWriter();
+
+    void Begin(RecordingSink sink, void* context, uint32_t millis);
+
+    void WriteLoop(uint32_t millis);
+
+    // values are in HistoryField order, NAN for absent sensors.
+    // Nothing is written if no value has changed.
+    void WriteSensorReadings(uint32_t millis, uint8_t unit, const float values[RECORDING_FIELD_COUNT]);
+
+    void WriteI2cError(uint32_t millis, uint8_t unit, RecordingSensor sensor);
+
+    // Only written when the state differs from the last one written for the unit
+    void WriteUnitState(uint32_t millis, uint8_t unit, uint8_t channel, uint8_t sensorMask);
+
+    // Only written when the state differs from the last one written for the link
+    void WriteLinkState(uint32_t millis, RecordingLink link, int8_t state);
+
+    void WritePublish(uint32_t millis, uint8_t decision, bool isSent);
+
+    uint32_t GetBytesWritten() const { return bytesWritten; }
+
+private:
+    void WriteRecordStart(RecordType type, uint32_t millis);
+    void WriteVarint(uint32_t value);
+    void WriteBytes(const uint8_t* data, size_t length);
+
+    RecordingSink sink;
+    void* context;
+    uint32_t lastMillis;
+    uint32_t bytesWritten;
+
+    uint32_t lastValues[RECORDING_MAX_UNITS][RECORDING_FIELD_COUNT];
+    bool hasLastValues[RECORDING_MAX_UNITS];
+    uint8_t lastChannels[RECORDING_MAX_UNITS];
+    uint8_t lastSensorMasks[RECORDING_MAX_UNITS];
+    bool hasLastUnitStates[RECORDING_MAX_UNITS];
+    int8_t lastLinkStates[RECORDING_LINK_COUNT];
+    bool hasLastLinkStates[RECORDING_LINK_COUNT];
+};
+
+class RecordingReader {
+public:
+    RecordingReader(const uint8_t* data, size_t length);
+
+    bool IsValid() const { return isValid; }
+
+    // Returns false at the end of the log, or at a truncated or unknown record
+    bool Next(RecordingEvent& event);
+
+private:
+    bool ReadByte(uint8_t& value);
+    bool ReadVarint(uint32_t& value);
+
+    const uint8_t* data;
+    size_t length;
+    size_t position;
+    bool isValid;
+    uint32_t millis;
+
+    float unitValues[RECORDING_MAX_UNITS][RECORDING_FIELD_COUNT];
+};
+
+#endif
@@ -0,0 +1,329 @@
+#include "RuleEngine.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <Trace.h>
+
+// Longest config line, including any comment
+#define RULES_MAX_LINE_LENGTH 96
+
+// A triggered rise/fall rule clears once the change drops below this fraction of its amount
+#define RULES_RATE_CLEAR_FRACTION 0.5f
+
+static const char* const ruleFieldNames[] = {
+    "sht4x_temperature",
+    "sht4x_humidity",
+    "bmp280_temperature",
+    "bmp280_pressure",
+    "scd4x_temperature",
+    "scd4x_humidity",
+    "scd4x_co2",
+};
+
+static_assert(sizeof(ruleFieldNames) / sizeof(ruleFieldNames[0]) == RULES_FIELD_COUNT,
+    "A name is needed for each history field");
+
+static const char* const ruleKindNames[] = {
+    "above",
+    "below",
+    "rise",
+    "fall",
+    "stale",
+};
+
+const char* GetRuleFieldName(int field) {
+    if (field < 0 || field >= RULES_FIELD_COUNT) {
+        return "unknown";
+    }
+
+    return ruleFieldNames[field];
+}
+
+static int FindName(const char* name, const char* const* names, int count) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// Returns false for a malformed line. isEmpty is set for blank and comment lines.
+static bool ParseRule(char* line, Rule& rule, bool& isEmpty) {
+    char* comment = strchr(line, '#');
+    if (comment != nullptr) {
+        *comment = '\0';
+    }
+
+    char name[RULES_NAME_LENGTH];
+    char unit[8];
+    char field[24];
+    char kind[8];
+    float first;
+    float second;
+
+    int count = sscanf(line, "%15s %7s %23s %7s %f %f", name, unit, field, kind, &first, &second);
+
+    isEmpty = count <= 0;
+    if (isEmpty) {
+        return true;
+    }
+
+    if (count < 5) {
+        return false;
+    }
+
+    strncpy(rule.name, name, sizeof(rule.name));
+    rule.name[sizeof(rule.name) - 1] = '\0';
+
+    if (strcmp(unit, "*") == 0) {
+        rule.channel = RULES_ANY_UNIT;
+    } else if (strcmp(unit, "bus") == 0) {
+        rule.channel = 0;
+    } else {
+        char* end;
+        long channel = strtol(unit, &end, 10);
+        if (*end != '\0' || channel < 0 || channel >= RULES_MAX_UNITS) {
+            return false;
+        }
+        rule.channel = (uint8_t)channel;
+    }
+
+    int fieldIndex = FindName(field, ruleFieldNames, RULES_FIELD_COUNT);
+    int kindIndex = FindName(kind, ruleKindNames, sizeof(ruleKindNames) / sizeof(ruleKindNames[0]));
+    if (fieldIndex < 0 || kindIndex < 0) {
+        return false;
+    }
+
+    rule.field = (uint8_t)fieldIndex;
+    rule.kind = (RuleKind)kindIndex;
+
+    switch (rule.kind) {
+        case RULE_ABOVE:
+        case RULE_BELOW:
+            if (count != 6) {
+                return false;
+            }
+            rule.threshold = first;
+            rule.parameter = second;
+            // The clear level must be on the far side of the trigger level
+            return rule.kind == RULE_ABOVE ? second <= first : second >= first;
+
+        case RULE_RISE:
+        case RULE_FALL:
+            if (count != 6 || first <= 0.0f || second <= 0.0f) {
+                return false;
+            }
+            rule.threshold = first;
+            rule.parameter = second * 1000.0f;
+            return true;
+
+        case RULE_STALE:
+            if (count != 5 || first <= 0.0f) {
+                return false;
+            }
+            rule.threshold = first * 1000.0f;
+            rule.parameter = 0.0f;
+            return true;
+    }
+
+    return false;
+}
+
+RuleEngine::RuleEngine() : ruleCount(0), sink(nullptr), context(nullptr) {
+    ResetStates();
+}
+
+bool RuleEngine::LoadConfig(const char* text, int& errorLine) {
+    Rule parsedRules[RULES_MAX_RULES];
+    int parsedCount = 0;
+    int lineNumber = 0;
+
+    errorLine = 0;
+
+    while (*text != '\0') {
+        lineNumber++;
+
+        const char* lineEnd = strchr(text, '\n');
+        size_t lineLength = lineEnd != nullptr ? (size_t)(lineEnd - text) : strlen(text);
+
+        if (lineLength >= RULES_MAX_LINE_LENGTH) {
+            errorLine = lineNumber;
+            return false;
+        }
+
+        char line[RULES_MAX_LINE_LENGTH];
+        memcpy(line, text, lineLength);
+        line[lineLength] = '\0';
+
+        text += lineLength;
+        if (*text == '\n') {
+            text++;
+        }
+
+        Rule rule;
+        bool isEmpty;
+        if (!ParseRule(line, rule, isEmpty) || (!isEmpty && parsedCount == RULES_MAX_RULES)) {
+            errorLine = lineNumber;
+            return false;
+        }
+
+        if (!isEmpty) {
+            parsedRules[parsedCount++] = rule;
+        }
+    }
+
+    memcpy(rules, parsedRules, sizeof(Rule) * parsedCount);
+    ruleCount = parsedCount;
+    ResetStates();
+
+    return true;
+}
+
+void RuleEngine::SetAlertSink(RuleAlertSink sink, void* context) {
+    this->sink = sink;
+    this->context = context;
+}
+
+void RuleEngine::Evaluate(uint32_t millis, uint8_t channel, const float values[RULES_FIELD_COUNT]) {
+    TRACE_SCOPE("RuleEngine::Evaluate");
+
+    if (channel >= RULES_MAX_UNITS) {
+        return;
+    }
+
+    for (int i = 0; i < ruleCount; i++) {
+        const Rule& rule = rules[i];
+
+        if (rule.channel != RULES_ANY_UNIT && rule.channel != channel) {
+            continue;
+        }
+
+        RuleState& state = states[i][channel];
+
+        float alertValue = NAN;
+        bool isTriggered = EvaluateRule(rule, state, millis, values[rule.field], alertValue);
+
+        if (isTriggered == state.isTriggered) {
+            continue;
+        }
+
+        state.isTriggered = isTriggered;
+
+        if (sink != nullptr) {
+            RuleAlert alert;
+            alert.rule = &rule;
+            alert.channel = channel;
+            alert.isTriggered = isTriggered;
+            alert.value = alertValue;
+
+            sink(alert, context);
+        }
+    }
+}
+
+// Returns whether the rule is triggered after this value
+bool RuleEngine::EvaluateRule(const Rule& rule, RuleState& state, uint32_t millis, float value, float& alertValue) {
+    switch (rule.kind) {
+        case RULE_ABOVE:
+            if (isnan(value)) {
+                return state.isTriggered;
+            }
+
+            alertValue = value;
+            return state.isTriggered ? value > rule.parameter : value >= rule.threshold;
+
+        case RULE_BELOW:
+            if (isnan(value)) {
+                return state.isTriggered;
+            }
+
+            alertValue = value;
+            return state.isTriggered ? value < rule.parameter : value <= rule.threshold;
+
+        case RULE_RISE:
+        case RULE_FALL:
+            return EvaluateRate(rule, state, millis, value, alertValue);
+
+        case RULE_STALE:
+            return EvaluateStale(rule, state, millis, value, alertValue);
+    }
+
+    return false;
+}
+
+bool RuleEngine::EvaluateStale(const Rule& rule, RuleState& state, uint32_t millis, float value, float& alertValue) {
+    // A steady reading is still a successful read, so only a failed or missing read ages
+    if (!isnan(value)) {
+        state.hasRead = true;
+        state.lastReadMillis = millis;
+    }
+
+    // A sensor which has never been read isn't stale, just absent
+    if (!state.hasRead) {
+        return false;
+    }
+
+    uint32_t ageMillis = millis - state.lastReadMillis;
+    alertValue = ageMillis / 1000.0f;
+
+    return ageMillis >= rule.threshold;
+}
+
+bool RuleEngine::EvaluateRate(const Rule& rule, RuleState& state, uint32_t millis, float value, float& alertValue) {
+    // Without readings there is no change to hold the alert on, and the window restarts
+    // when the sensor returns, so it would otherwise never clear
+    if (isnan(value)) {
+        state.bucketCount = 0;
+        return false;
+    }
+
+    uint32_t windowMillis = (uint32_t)rule.parameter;
+    uint32_t bucketMillis = windowMillis / RULES_RATE_BUCKETS;
+    uint32_t bucketAgeMillis = millis - state.bucketStartMillis;
+
+    if (state.bucketCount == 0 || bucketAgeMillis >= windowMillis) {
+        // Everything held is older than the window
+        state.bucketCount = 1;
+        state.bucketIndex = 0;
+        state.bucketStartMillis = millis;
+        state.bucketMin[0] = value;
+        state.bucketMax[0] = value;
+    } else if (bucketAgeMillis >= bucketMillis) {
+        // Start a new slice, dropping the oldest
+        state.bucketIndex = (state.bucketIndex + 1) % RULES_RATE_BUCKETS;
+        if (state.bucketCount < RULES_RATE_BUCKETS) {
+            state.bucketCount++;
+        }
+        state.bucketStartMillis = millis;
+        state.bucketMin[state.bucketIndex] = value;
+        state.bucketMax[state.bucketIndex] = value;
+    } else {
+        state.bucketMin[state.bucketIndex] = fminf(state.bucketMin[state.bucketIndex], value);
+        state.bucketMax[state.bucketIndex] = fmaxf(state.bucketMax[state.bucketIndex], value);
+    }
+
+    float lowest = value;
+    float highest = value;
+    for (int i = 0; i < state.bucketCount; i++) {
+        lowest = fminf(lowest, state.bucketMin[i]);
+        highest = fmaxf(highest, state.bucketMax[i]);
+    }
+
+    float change = rule.kind == RULE_RISE ? value - lowest : highest - value;
+    alertValue = change;
+
+    if (state.isTriggered) {
+        return change >= rule.threshold * RULES_RATE_CLEAR_FRACTION;
+    }
+
+    return change >= rule.threshold;
+}
+
+void RuleEngine::ResetStates() {
+    memset(states, 0, sizeof(states));
+}
@@ -0,0 +1,132 @@
+#ifndef RULE_ENGINE_H
+#define RULE_ENGINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <TimeSeriesCodec.h>
+
+// Alert rules evaluated against every sensor sample.
+// Kept free of Arduino dependencies so the evaluation cost can be measured on the host,
+// see tools/rules_bench.
+//
+// Rules are loaded from text, one per line, '#' starting a comment:
+//   <name> <unit> <field> above <trigger> <clear>
+//   <name> <unit> <field> below <trigger> <clear>
+//   <name> <unit> <field> rise <amount> <seconds>
+//   <name> <unit> <field> fall <amount> <seconds>
+//   <name> <unit> <field> stale <seconds>
+// unit is the unit's channel as printed over serial and published in MQTT, 0 or bus for a unit on the
+// main bus, or * for every unit.
+// name is at most RULES_NAME_LENGTH - 1 characters; a longer one fails to parse.
+// field is a history field name, see GetRuleFieldName.
+//
+// above/below trigger at the trigger level and clear once past the clear level.
+// rise/fall trigger when the value has changed by the amount within about the given time,
+// and clear if the sensor stops reporting.
+// stale triggers when a sensor which has been read hasn't been read successfully for the given time.
+
+#define RULES_MAX_RULES 8
+
+// Channels are below this. At least MAX_ENV_UNITS, which src/Alerts.cpp checks.
+// Raise it with PAHUB_MAX_COUNT.
+#ifndef RULES_MAX_UNITS
+    #define RULES_MAX_UNITS 12
+#endif
+
+#define RULES_NAME_LENGTH 16
+
+// Values are in HistoryField order
+#define RULES_FIELD_COUNT HISTORY_FIELD_COUNT
+
+// rise/fall keep the minimum and maximum over this many slices of their window
+#define RULES_RATE_BUCKETS 4
+
+#define RULES_ANY_UNIT 0xFF
+
+enum RuleKind {
+    RULE_ABOVE = 0,
+    RULE_BELOW,
+    RULE_RISE,
+    RULE_FALL,
+    RULE_STALE,
+};
+
+struct Rule {
+    char name[RULES_NAME_LENGTH];
+    // Channel or RULES_ANY_UNIT
+    uint8_t channel;
+    uint8_t field;
+    RuleKind kind;
+
+    // The trigger level, the amount of change, or the stale time in milliseconds
+    float threshold;
+    // The clear level, or the rise/fall window in milliseconds
+    float parameter;
+};
+
+struct RuleAlert {
+    const Rule* rule;
+    uint8_t channel;
+    // False when the rule clears
+    bool isTriggered;
+    // The value for above/below, the change over the window for rise/fall,
+    // the seconds since the last successful read for stale.
+    // NAN when a rise/fall clears because the sensor stopped reporting.
+    float value;
+};
+
+typedef void (*RuleAlertSink)(const RuleAlert& alert, void* context);
+
+class RuleEngine {
+public:
+    RuleEngine();
+
+    // Replaces the rules. On a parse error the current rules are kept and
+    // errorLine is set to the 1-based line which failed.
+    bool LoadConfig(const char* text, int& errorLine);
+
+    int GetRuleCount() const { return ruleCount; }
+    const Rule& GetRule(int index) const { return rules[index]; }
+
+    // Called for each rule which triggers or clears
+    void SetAlertSink(RuleAlertSink sink, void* context);
+
+    // Call for each unit after each read, with its channel.
+    // values are NAN for absent sensors and failed reads.
+    void Evaluate(uint32_t millis, uint8_t channel, const float values[RULES_FIELD_COUNT]);
+
+private:
+    struct RuleState {
+        bool isTriggered;
+
+        // stale
+        bool hasRead;
+        uint32_t lastReadMillis;
+
+        // rise/fall
+        uint8_t bucketCount;
+        uint8_t bucketIndex;
+        uint32_t bucketStartMillis;
+        float bucketMin[RULES_RATE_BUCKETS];
+        float bucketMax[RULES_RATE_BUCKETS];
+    };
+
+    bool EvaluateRule(const Rule& rule, RuleState& state, uint32_t millis, float value, float& alertValue);
+    bool EvaluateStale(const Rule& rule, RuleState& state, uint32_t millis, float value, float& alertValue);
+    bool EvaluateRate(const Rule& rule, RuleState& state, uint32_t millis, float value, float& alertValue);
+    void ResetStates();
+
+    Rule rules[RULES_MAX_RULES];
+    int ruleCount;
+    // Indexed by channel
+    RuleState states[RULES_MAX_RULES][RULES_MAX_UNITS];
+
+    RuleAlertSink sink;
+    void* context;
+};
+
+// The names used in rules, matching the history CSV columns
+const char* GetRuleFieldName(int field);
+
+#endif
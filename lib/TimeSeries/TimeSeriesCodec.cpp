@@ -0,0 +1,284 @@
+#include "TimeSeriesCodec.h"
+
+#include <string.h>
+
+#include <Trace.h>
+
+// Largest number of bits a single sample can take:
+// a 4 bit timestamp prefix with a 32 bit delta-of-delta,
+// then per field a 2 bit prefix, 5 bit leading zeros, 5 bit length and 32 bits of XOR
+#define MAX_SAMPLE_BITS (36 + HISTORY_FIELD_COUNT * 44)
+
+#define NO_WINDOW 0xFF
+
+static uint32_t FloatToBits(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static float BitsToFloat(uint32_t bits) {
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// ========
+// Encoder
+// ========
+
+HistoryChunkEncoder::HistoryChunkEncoder(uint8_t* buffer, size_t capacityBytes)
+    : buffer(buffer), capacityBytes(capacityBytes) {
+    // The bit length is stored in 16 bits
+    if (this->capacityBytes > 0xFFFF / 8) {
+        this->capacityBytes = 0xFFFF / 8;
+    }
+
+    Reset();
+}
+
+void HistoryChunkEncoder::Reset() {
+    memset(buffer, 0, capacityBytes);
+
+    header.magic = HISTORY_CHUNK_MAGIC;
+    header.firstTimestamp = 0;
+    header.lastTimestamp = 0;
+    header.sampleCount = 0;
+    header.bitLength = 0;
+
+    previousDelta = 0;
+    for (int i = 0; i < HISTORY_FIELD_COUNT; i++) {
+        previousValues[i] = 0;
+        previousLeading[i] = NO_WINDOW;
+        previousTrailing[i] = NO_WINDOW;
+    }
+}
+
+bool HistoryChunkEncoder::Append(const HistorySample& sample) {
+    TRACE_SCOPE("HistoryChunkEncoder::Append");
+
+    if (header.sampleCount == 0xFFFF) {
+        return false;
+    }
+
+    if ((size_t)header.bitLength + MAX_SAMPLE_BITS > capacityBytes * 8) {
+        return false;
+    }
+
+    if (header.sampleCount > 0 && sample.timestamp <= header.lastTimestamp) {
+        return false;
+    }
+
+    WriteTimestamp(sample.timestamp);
+
+    for (int i = 0; i < HISTORY_FIELD_COUNT; i++) {
+        WriteValue(i, FloatToBits(sample.values[i]));
+    }
+
+    if (header.sampleCount == 0) {
+        header.firstTimestamp = sample.timestamp;
+    }
+    header.lastTimestamp = sample.timestamp;
+    header.sampleCount++;
+
+    return true;
+}
+
+void HistoryChunkEncoder::WriteBits(uint32_t value, uint8_t bitCount) {
+    while (bitCount > 0) {
+        uint8_t bitOffset = header.bitLength & 7;
+        uint8_t freeBits = 8 - bitOffset;
+        uint8_t take = bitCount < freeBits ? bitCount : freeBits;
+
+        uint8_t bits = (value >> (bitCount - take)) & ((1U << take) - 1);
+        buffer[header.bitLength >> 3] |= bits << (freeBits - take);
+
+        header.bitLength += take;
+        bitCount -= take;
+    }
+}
+
+void HistoryChunkEncoder::WriteTimestamp(uint32_t timestamp) {
+    if (header.sampleCount == 0) {
+        WriteBits(timestamp, 32);
+        return;
+    }
+
+    int32_t delta = (int32_t)(timestamp - header.lastTimestamp);
+    int32_t deltaOfDelta = delta - previousDelta;
+    previousDelta = delta;
+
+    if (deltaOfDelta == 0) {
+        WriteBits(0b0, 1);
+    } else if (deltaOfDelta >= -63 && deltaOfDelta <= 64) {
+        WriteBits(0b10, 2);
+        WriteBits(deltaOfDelta + 63, 7);
+    } else if (deltaOfDelta >= -255 && deltaOfDelta <= 256) {
+        WriteBits(0b110, 3);
+        WriteBits(deltaOfDelta + 255, 9);
+    } else if (deltaOfDelta >= -2047 && deltaOfDelta <= 2048) {
+        WriteBits(0b1110, 4);
+        WriteBits(deltaOfDelta + 2047, 12);
+    } else {
+        WriteBits(0b1111, 4);
+        WriteBits((uint32_t)deltaOfDelta, 32);
+    }
+}
+
+void HistoryChunkEncoder::WriteValue(int field, uint32_t valueBits) {
+    if (header.sampleCount == 0) {
+        WriteBits(valueBits, 32);
+        previousValues[field] = valueBits;
+        return;
+    }
+
+    uint32_t xorBits = valueBits ^ previousValues[field];
+    previousValues[field] = valueBits;
+
+    if (xorBits == 0) {
+        WriteBits(0b0, 1);
+        return;
+    }
+
+    uint8_t leading = __builtin_clz(xorBits);
+    uint8_t trailing = __builtin_ctz(xorBits);
+
+    // Reuse the previous window if the meaningful bits fit inside it
+    if (previousLeading[field] != NO_WINDOW
+            && leading >= previousLeading[field]
+            && trailing >= previousTrailing[field]) {
+        uint8_t meaningfulBits = 32 - previousLeading[field] - previousTrailing[field];
+        WriteBits(0b10, 2);
+        WriteBits(xorBits >> previousTrailing[field], meaningfulBits);
+        return;
+    }
+
+    uint8_t meaningfulBits = 32 - leading - trailing;
+    WriteBits(0b11, 2);
+    WriteBits(leading, 5);
+    WriteBits(meaningfulBits - 1, 5);
+    WriteBits(xorBits >> trailing, meaningfulBits);
+
+    previousLeading[field] = leading;
+    previousTrailing[field] = trailing;
+}
+
+// ========
+// Decoder
+// ========
+
+HistoryChunkDecoder::HistoryChunkDecoder() : data(nullptr), bitPosition(0), samplesRead(0) {
+    header.magic = HISTORY_CHUNK_MAGIC;
+    header.firstTimestamp = 0;
+    header.lastTimestamp = 0;
+    header.sampleCount = 0;
+    header.bitLength = 0;
+}
+
+HistoryChunkDecoder::HistoryChunkDecoder(const HistoryChunkHeader& header, const uint8_t* data) {
+    Reset(header, data);
+}
+
+void HistoryChunkDecoder::Reset(const HistoryChunkHeader& header, const uint8_t* data) {
+    this->header = header;
+    this->data = data;
+    bitPosition = 0;
+    samplesRead = 0;
+
+    previousTimestamp = 0;
+    previousDelta = 0;
+    for (int i = 0; i < HISTORY_FIELD_COUNT; i++) {
+        previousValues[i] = 0;
+        previousLeading[i] = NO_WINDOW;
+        previousTrailing[i] = NO_WINDOW;
+    }
+}
+
+bool HistoryChunkDecoder::Next(HistorySample& sample) {
+    if (data == nullptr || samplesRead >= header.sampleCount) {
+        return false;
+    }
+
+    sample.timestamp = ReadTimestamp();
+
+    for (int i = 0; i < HISTORY_FIELD_COUNT; i++) {
+        sample.values[i] = BitsToFloat(ReadValue(i));
+    }
+
+    samplesRead++;
+
+    return true;
+}
+
+uint32_t HistoryChunkDecoder::ReadBits(uint8_t bitCount) {
+    uint32_t value = 0;
+
+    while (bitCount > 0) {
+        uint8_t bitOffset = bitPosition & 7;
+        uint8_t availableBits = 8 - bitOffset;
+        uint8_t take = bitCount < availableBits ? bitCount : availableBits;
+
+        uint8_t bits = (data[bitPosition >> 3] >> (availableBits - take)) & ((1U << take) - 1);
+        value = (value << take) | bits;
+
+        bitPosition += take;
+        bitCount -= take;
+    }
+
+    return value;
+}
+
+uint32_t HistoryChunkDecoder::ReadTimestamp() {
+    if (samplesRead == 0) {
+        previousTimestamp = ReadBits(32);
+        return previousTimestamp;
+    }
+
+    int32_t deltaOfDelta;
+    if (ReadBits(1) == 0b0) {
+        deltaOfDelta = 0;
+    } else if (ReadBits(1) == 0b0) {
+        deltaOfDelta = (int32_t)ReadBits(7) - 63;
+    } else if (ReadBits(1) == 0b0) {
+        deltaOfDelta = (int32_t)ReadBits(9) - 255;
+    } else if (ReadBits(1) == 0b0) {
+        deltaOfDelta = (int32_t)ReadBits(12) - 2047;
+    } else {
+        deltaOfDelta = (int32_t)ReadBits(32);
+    }
+
+    previousDelta += deltaOfDelta;
+    previousTimestamp += previousDelta;
+
+    return previousTimestamp;
+}
+
+uint32_t HistoryChunkDecoder::ReadValue(int field) {
+    if (samplesRead == 0) {
+        previousValues[field] = ReadBits(32);
+        return previousValues[field];
+    }
+
+    if (ReadBits(1) == 0b0) {
+        return previousValues[field];
+    }
+
+    uint32_t xorBits;
+    if (ReadBits(1) == 0b0) {
+        uint8_t meaningfulBits = 32 - previousLeading[field] - previousTrailing[field];
+        xorBits = ReadBits(meaningfulBits) << previousTrailing[field];
+    } else {
+        uint8_t leading = ReadBits(5);
+        uint8_t meaningfulBits = ReadBits(5) + 1;
+        uint8_t trailing = 32 - leading - meaningfulBits;
+
+        xorBits = ReadBits(meaningfulBits) << trailing;
+
+        previousLeading[field] = leading;
+        previousTrailing[field] = trailing;
+    }
+
+    previousValues[field] ^= xorBits;
+
+    return previousValues[field];
+}
@@ -0,0 +1,97 @@
+#ifndef TIME_SERIES_CODEC_H
+#define TIME_SERIES_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Gorilla-style block codec for the sensor history.
+// Timestamps are stored as delta-of-deltas, values as XORs against the
+// previous value of the same field. Both are bit-packed MSB first.
+
+#define HISTORY_FIELD_COUNT 7
+#define HISTORY_CHUNK_BYTES 2048
+#define HISTORY_CHUNK_MAGIC 0x31535448UL // "HTS1"
+
+enum HistoryField {
+    HISTORY_SHT4X_TEMPERATURE = 0,
+    HISTORY_SHT4X_HUMIDITY,
+    HISTORY_BMP280_TEMPERATURE,
+    HISTORY_BMP280_PRESSURE,
+    HISTORY_SCD4X_TEMPERATURE,
+    HISTORY_SCD4X_HUMIDITY,
+    HISTORY_SCD4X_CO2,
+};
+
+struct HistorySample {
+    // Unix time in seconds
+    uint32_t timestamp;
+    // NAN for sensors which were not initialised
+    float values[HISTORY_FIELD_COUNT];
+};
+
+struct HistoryChunkHeader {
+    uint32_t magic;
+    uint32_t firstTimestamp;
+    uint32_t lastTimestamp;
+    uint16_t sampleCount;
+    uint16_t bitLength;
+};
+
+class HistoryChunkEncoder {
+public:
+    HistoryChunkEncoder(uint8_t* buffer, size_t capacityBytes);
+
+    void Reset();
+
+    // Returns false when the chunk has no room for another sample.
+    // Timestamps must be strictly increasing.
+    bool Append(const HistorySample& sample);
+
+    const HistoryChunkHeader& Header() const { return header; }
+    const uint8_t* Data() const { return buffer; }
+    size_t SizeBytes() const { return (header.bitLength + 7) / 8; }
+    bool IsEmpty() const { return header.sampleCount == 0; }
+
+private:
+    void WriteBits(uint32_t value, uint8_t bitCount);
+    void WriteTimestamp(uint32_t timestamp);
+    void WriteValue(int field, uint32_t valueBits);
+
+    uint8_t* buffer;
+    size_t capacityBytes;
+    HistoryChunkHeader header;
+
+    int32_t previousDelta;
+    uint32_t previousValues[HISTORY_FIELD_COUNT];
+    uint8_t previousLeading[HISTORY_FIELD_COUNT];
+    uint8_t previousTrailing[HISTORY_FIELD_COUNT];
+};
+
+class HistoryChunkDecoder {
+public:
+    HistoryChunkDecoder();
+    HistoryChunkDecoder(const HistoryChunkHeader& header, const uint8_t* data);
+
+    void Reset(const HistoryChunkHeader& header, const uint8_t* data);
+
+    // Returns false once every sample in the chunk has been read
+    bool Next(HistorySample& sample);
+
+private:
+    uint32_t ReadBits(uint8_t bitCount);
+    uint32_t ReadTimestamp();
+    uint32_t ReadValue(int field);
+
+    HistoryChunkHeader header;
+    const uint8_t* data;
+    uint32_t bitPosition;
+    uint16_t samplesRead;
+
+    uint32_t previousTimestamp;
+    int32_t previousDelta;
+    uint32_t previousValues[HISTORY_FIELD_COUNT];
+    uint8_t previousLeading[HISTORY_FIELD_COUNT];
+    uint8_t previousTrailing[HISTORY_FIELD_COUNT];
+};
+
+#endif
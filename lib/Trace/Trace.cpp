@@ -0,0 +1,165 @@
+#include "Trace.h"
+
+#include <atomic>
+#include <stdio.h>
+
+#ifdef ARDUINO
+    #include <Arduino.h>
+#else
+    #include <chrono>
+#endif
+
+#define TRACE_LINE_LENGTH 96
+
+uint32_t GetTraceCycles() {
+#ifdef ARDUINO
+    return ESP.getCycleCount();
+#else
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+#endif
+}
+
+uint32_t GetTraceCyclesPerMicrosecond() {
+#ifdef ARDUINO
+    return getCpuFrequencyMhz();
+#else
+    return 1000;
+#endif
+}
+
+#ifdef THERMO_TRACE
+
+static uint8_t GetTraceCore() {
+#ifdef ARDUINO
+    return xPortGetCoreID();
+#else
+    return 0;
+#endif
+}
+
+// A task stalled mid-write can be lapped by the other, which then rewrites the same slot.
+// Relaxed atomic fields (plain stores on the ESP32) make that a mixed event rather than a data race.
+struct TraceSlot {
+    std::atomic<const char*> name;
+    std::atomic<uint32_t> startCycles;
+    std::atomic<uint32_t> durationCycles;
+    std::atomic<uint8_t> core;
+};
+
+static TraceSlot traceSlots[TRACE_BUFFER_EVENTS];
+
+// Total events ever recorded; the slot is this modulo the buffer size
+static std::atomic<uint32_t> traceEventCount(0);
+static std::atomic<bool> isTracePaused(false);
+
+void RecordTraceEvent(const char* name, uint32_t startCycles, uint32_t endCycles) {
+    if (isTracePaused.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    // Claiming a slot atomically lets the WiFi event task record alongside loop()
+    uint32_t index = traceEventCount.fetch_add(1, std::memory_order_relaxed);
+
+    TraceSlot& slot = traceSlots[index % TRACE_BUFFER_EVENTS];
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.startCycles.store(startCycles, std::memory_order_relaxed);
+    slot.durationCycles.store(endCycles - startCycles, std::memory_order_relaxed);
+    slot.core.store(GetTraceCore(), std::memory_order_relaxed);
+}
+
+static TraceEvent LoadTraceEvent(uint32_t index) {
+    const TraceSlot& slot = traceSlots[index % TRACE_BUFFER_EVENTS];
+
+    TraceEvent event;
+    event.name = slot.name.load(std::memory_order_relaxed);
+    event.startCycles = slot.startCycles.load(std::memory_order_relaxed);
+    event.durationCycles = slot.durationCycles.load(std::memory_order_relaxed);
+    event.core = slot.core.load(std::memory_order_relaxed);
+    return event;
+}
+
+bool IsTraceEnabled() {
+    return true;
+}
+
+void ResetTrace() {
+    traceEventCount.store(0);
+}
+
+void SetTracePaused(bool isPaused) {
+    isTracePaused.store(isPaused);
+}
+
+static size_t FormatTraceHeader(char* line) {
+    uint32_t total = traceEventCount.load();
+    uint32_t count = total < TRACE_BUFFER_EVENTS ? total : TRACE_BUFFER_EVENTS;
+
+    return snprintf(line, TRACE_LINE_LENGTH, "# thermo_iot trace,cycles_per_us=%lu,events=%lu,dropped=%lu",
+        (unsigned long)GetTraceCyclesPerMicrosecond(), (unsigned long)count, (unsigned long)(total - count));
+}
+
+static size_t FormatTraceEvent(char* line, const TraceEvent& event) {
+    return snprintf(line, TRACE_LINE_LENGTH, "%s,%u,%lu,%lu",
+        event.name, event.core, (unsigned long)event.startCycles, (unsigned long)event.durationCycles);
+}
+
+void WriteTraceDump(TraceLineWriter writer, void* context) {
+    char line[TRACE_LINE_LENGTH];
+
+    FormatTraceHeader(line);
+    writer(line, context);
+
+    uint32_t total = traceEventCount.load();
+    uint32_t first = total > TRACE_BUFFER_EVENTS ? total - TRACE_BUFFER_EVENTS : 0;
+
+    for (uint32_t i = first; i < total; i++) {
+        FormatTraceEvent(line, LoadTraceEvent(i));
+        writer(line, context);
+    }
+}
+
+size_t MeasureTraceDump() {
+    char line[TRACE_LINE_LENGTH];
+
+    // snprintf returns the untruncated length, so clamp to what is written
+    size_t length = FormatTraceHeader(line);
+    length = (length < TRACE_LINE_LENGTH ? length : TRACE_LINE_LENGTH - 1) + 1;
+
+    uint32_t total = traceEventCount.load();
+    uint32_t first = total > TRACE_BUFFER_EVENTS ? total - TRACE_BUFFER_EVENTS : 0;
+
+    for (uint32_t i = first; i < total; i++) {
+        size_t lineLength = FormatTraceEvent(line, LoadTraceEvent(i));
+        length += (lineLength < TRACE_LINE_LENGTH ? lineLength : TRACE_LINE_LENGTH - 1) + 1;
+    }
+
+    return length;
+}
+
+#else
+
+void RecordTraceEvent(const char*, uint32_t, uint32_t) {
+}
+
+bool IsTraceEnabled() {
+    return false;
+}
+
+void ResetTrace() {
+}
+
+void SetTracePaused(bool) {
+}
+
+#define TRACE_DISABLED_LINE "# thermo_iot trace,disabled"
+
+void WriteTraceDump(TraceLineWriter writer, void* context) {
+    writer(TRACE_DISABLED_LINE, context);
+}
+
+size_t MeasureTraceDump() {
+    return sizeof(TRACE_DISABLED_LINE);
+}
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Scoped trace events recorded into a fixed ring buffer.
+// Compiled out unless THERMO_TRACE is defined, in which case TRACE_SCOPE costs
+// two cycle counter reads and a slot claim.
+//
+// The dump is one event per line and can be converted to Chrome/Perfetto
+// trace JSON with tools/trace_to_chrome.py.
+
+#ifndef TRACE_BUFFER_EVENTS
+    #define TRACE_BUFFER_EVENTS 512
+#endif
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#ifdef THERMO_TRACE
+    // name must be a string literal, only the pointer is stored
+    #define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#else
+    #define TRACE_SCOPE(name)
+#endif
+
+struct TraceEvent {
+    const char* name;
+    uint32_t startCycles;
+    uint32_t durationCycles;
+    uint8_t core;
+};
+
+// On the ESP32 this is the CPU cycle counter.
+// On the host it is a nanosecond clock.
+uint32_t GetTraceCycles();
+
+uint32_t GetTraceCyclesPerMicrosecond();
+
+void RecordTraceEvent(const char* name, uint32_t startCycles, uint32_t endCycles);
+
+bool IsTraceEnabled();
+
+// Clears the buffer
+void ResetTrace();
+
+typedef void (*TraceLineWriter)(const char* line, void* context);
+
+// Stops new events being recorded, so a dump can be measured then written
+void SetTracePaused(bool isPaused);
+
+// Writes a header line then "name,core,startCycles,durationCycles" per event, oldest first
+void WriteTraceDump(TraceLineWriter writer, void* context);
+
+// Length of the dump WriteTraceDump would produce, counting a newline per line
+size_t MeasureTraceDump();
+
+class TraceScope {
+public:
+    explicit TraceScope(const char* name) : name(name), startCycles(GetTraceCycles()) {}
+    ~TraceScope() { RecordTraceEvent(name, startCycles, GetTraceCycles()); }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name;
+    uint32_t startCycles;
+};
+
+#endif
@@ -0,0 +1,132 @@
+#include "Alerts.h"
+
+#include <string.h>
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <Trace.h>
+
+#include "EnvUnits.h"
+
+static_assert(RULES_MAX_UNITS >= MAX_ENV_UNITS, "RULES_MAX_UNITS must cover every ENV unit channel");
+
+static RuleEngine ruleEngine;
+
+static QueuedAlert alertQueue[ALERT_QUEUE_LENGTH];
+static int alertQueueStart = 0;
+static int alertQueueLength = 0;
+
+// Set for the sink, which only gets the rule and channel
+static uint32_t evaluationTimestamp = 0;
+static const EnvUnit* evaluationUnit = nullptr;
+
+static void QueueAlert(const RuleAlert& alert, void* context) {
+    if (alertQueueLength == ALERT_QUEUE_LENGTH) {
+        Serial.println("Alert queue is full; dropping the oldest alert");
+        PopAlert();
+    }
+
+    QueuedAlert& queued = alertQueue[(alertQueueStart + alertQueueLength) % ALERT_QUEUE_LENGTH];
+    alertQueueLength++;
+
+    strncpy(queued.rule, alert.rule->name, sizeof(queued.rule));
+    strncpy(queued.channel, evaluationUnit->label, sizeof(queued.channel));
+    queued.field = alert.rule->field;
+    queued.isTriggered = alert.isTriggered;
+    queued.value = alert.value;
+    queued.timestamp = evaluationTimestamp;
+
+    Serial.print("Alert ");
+    Serial.print(alert.isTriggered ? "triggered: " : "cleared: ");
+    Serial.print(queued.rule);
+    Serial.print(" [");
+    Serial.print(queued.channel);
+    Serial.print("] ");
+    Serial.println(queued.value);
+}
+
+static bool LoadAlertRules(const char* text) {
+    int errorLine;
+    if (!ruleEngine.LoadConfig(text, errorLine)) {
+        Serial.print("Invalid alert rule on line ");
+        Serial.println(errorLine);
+        return false;
+    }
+
+    Serial.print("Loaded alert rules: ");
+    Serial.println(ruleEngine.GetRuleCount());
+
+    return true;
+}
+
+void BeginAlerts() {
+    TRACE_SCOPE("BeginAlerts");
+
+    ruleEngine.SetAlertSink(QueueAlert, nullptr);
+
+    if (LittleFS.begin(true) && LittleFS.exists(ALERT_RULES_PATH)) {
+        File file = LittleFS.open(ALERT_RULES_PATH, FILE_READ);
+        String text = file.readString();
+        file.close();
+
+        if (LoadAlertRules(text.c_str())) {
+            return;
+        }
+    }
+
+    LoadAlertRules(ALERT_DEFAULT_RULES);
+}
+
+bool SetAlertRules(const char* text, unsigned int length) {
+    if (length > ALERT_RULES_MAX_BYTES) {
+        Serial.println("Alert rules are too long");
+        return false;
+    }
+
+    // The MQTT payload isn't null terminated
+    char terminated[ALERT_RULES_MAX_BYTES + 1];
+    memcpy(terminated, text, length);
+    terminated[length] = '\0';
+
+    if (!LoadAlertRules(terminated)) {
+        return false;
+    }
+
+    File file = LittleFS.open(ALERT_RULES_PATH, FILE_WRITE);
+    if (!file) {
+        Serial.println("Failed to save alert rules; they will be lost on reboot");
+        return true;
+    }
+
+    file.write((const uint8_t*)terminated, length);
+    file.close();
+
+    return true;
+}
+
+void EvaluateAlertRules(uint8_t unit, const float values[RULES_FIELD_COUNT], uint32_t timestamp) {
+    TRACE_SCOPE("EvaluateAlertRules");
+
+    const EnvUnit& envUnit = GetEnvUnit(unit);
+
+    evaluationTimestamp = timestamp;
+    evaluationUnit = &envUnit;
+    ruleEngine.Evaluate(millis(), envUnit.channel, values);
+}
+
+bool HasPendingAlert() {
+    return alertQueueLength > 0;
+}
+
+const QueuedAlert& PeekAlert() {
+    return alertQueue[alertQueueStart];
+}
+
+void PopAlert() {
+    if (alertQueueLength == 0) {
+        return;
+    }
+
+    alertQueueStart = (alertQueueStart + 1) % ALERT_QUEUE_LENGTH;
+    alertQueueLength--;
+}
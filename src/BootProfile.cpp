@@ -0,0 +1,58 @@
+#include "BootProfile.h"
+
+#include <Arduino.h>
+#include <esp_timer.h>
+
+static const char* bootPhaseNames[BOOT_PHASE_COUNT] = {
+    "setupStart",
+    "wifiStarted",
+    "sensorsInitialised",
+    "setupEnd",
+    "wifiConnected",
+    "wifiGotIp",
+    "wifiClientConnected",
+    "mqttConnected",
+    "ntpSynced",
+    "firstPublish",
+};
+
+static volatile uint32_t bootPhaseTimes[BOOT_PHASE_COUNT];
+static volatile bool hasReachedBootPhases[BOOT_PHASE_COUNT];
+
+void MarkBootPhase(BootPhase phase) {
+    if (hasReachedBootPhases[phase]) {
+        return;
+    }
+
+    // Counts from the app starting, as millis() does (which is derived from it);
+    // the ROM and second stage bootloader run before it and aren't included
+    bootPhaseTimes[phase] = (uint32_t)(esp_timer_get_time() / 1000);
+    hasReachedBootPhases[phase] = true;
+
+    Serial.print("Boot phase ");
+    Serial.print(bootPhaseNames[phase]);
+    Serial.print(": ");
+    Serial.print(bootPhaseTimes[phase]);
+    Serial.println("ms");
+}
+
+bool HasReachedBootPhase(BootPhase phase) {
+    return hasReachedBootPhases[phase];
+}
+
+uint32_t GetBootPhaseTime(BootPhase phase) {
+    return bootPhaseTimes[phase];
+}
+
+const char* GetBootPhaseName(BootPhase phase) {
+    return bootPhaseNames[phase];
+}
+
+void WriteBootProfileToJson(JsonDocument& doc) {
+    for (int i = 0; i < BOOT_PHASE_COUNT; i++) {
+        if (hasReachedBootPhases[i]) {
+            doc["phases"][bootPhaseNames[i]] = bootPhaseTimes[i];
+        }
+    }
+    doc["phases"]["unit"] = "ms";
+}
@@ -0,0 +1,216 @@
+#include "Capture.h"
+
+#include <Arduino.h>
+#include <string.h>
+
+#include "EnvUnits.h"
+
+static bool isCapturing = false;
+
+static uint32_t sequence = 0;
+static uint32_t framesDropped = 0;
+static uint32_t failedReads = 0;
+
+static uint32_t lastBmp280ReadAt[MAX_ENV_UNITS];
+static int nextSht4xUnit = 0;
+static unsigned long lastStatusAt = 0;
+
+static uint16_t UpdateCrc(uint16_t crc, const uint8_t* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+
+    return crc;
+}
+
+static void PutUint32(uint8_t* at, uint32_t value) {
+    at[0] = (uint8_t)value;
+    at[1] = (uint8_t)(value >> 8);
+    at[2] = (uint8_t)(value >> 16);
+    at[3] = (uint8_t)(value >> 24);
+}
+
+static void PutFloat(uint8_t* at, float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    PutUint32(at, bits);
+}
+
+// Dropped, leaving a gap in the sequence, if the serial buffer can't take it whole
+static void WriteFrame(CaptureFrameType type, uint32_t timestamp, const uint8_t* payload, uint8_t length) {
+    uint8_t frame[CAPTURE_HEADER_BYTES + CAPTURE_MAX_PAYLOAD_BYTES + CAPTURE_CRC_BYTES];
+    size_t size = CAPTURE_HEADER_BYTES + length + CAPTURE_CRC_BYTES;
+
+    frame[0] = CAPTURE_SYNC_0;
+    frame[1] = CAPTURE_SYNC_1;
+    frame[2] = (uint8_t)type;
+    frame[3] = length;
+    PutUint32(&frame[4], sequence++);
+    PutUint32(&frame[8], timestamp);
+    memcpy(&frame[CAPTURE_HEADER_BYTES], payload, length);
+
+    uint16_t crc = UpdateCrc(0xFFFF, &frame[2], CAPTURE_HEADER_BYTES - 2 + length);
+    frame[CAPTURE_HEADER_BYTES + length] = (uint8_t)crc;
+    frame[CAPTURE_HEADER_BYTES + length + 1] = (uint8_t)(crc >> 8);
+
+    if ((size_t)Serial.availableForWrite() < size) {
+        framesDropped++;
+        return;
+    }
+
+    Serial.write(frame, size);
+}
+
+static void WriteStatusFrame(CaptureFrameType type) {
+    uint8_t payload[8];
+    PutUint32(&payload[0], framesDropped);
+    PutUint32(&payload[4], failedReads);
+
+    WriteFrame(type, micros(), payload, sizeof(payload));
+}
+
+static void WriteReadingFrame(CaptureFrameType type, uint32_t readAt, int unit, float first, float second) {
+    uint8_t payload[9];
+    payload[0] = (uint8_t)unit;
+    PutFloat(&payload[1], first);
+    PutFloat(&payload[5], second);
+
+    WriteFrame(type, readAt, payload, sizeof(payload));
+}
+
+static void CaptureSht4x(int index) {
+    EnvUnit& unit = GetEnvUnit(index);
+
+    // Before the read, which starts the conversion and then waits for it
+    uint32_t readAt = micros();
+
+    if (!ReadEnvUnitSensor(index, RECORDING_SENSOR_SHT4X)) {
+        failedReads++;
+        return;
+    }
+
+    WriteReadingFrame(CAPTURE_FRAME_SHT4X, readAt, index, unit.sht4.cTemp, unit.sht4.humidity);
+}
+
+static void CaptureBmp280(int index, uint32_t readAt) {
+    EnvUnit& unit = GetEnvUnit(index);
+
+    if (!ReadEnvUnitSensor(index, RECORDING_SENSOR_BMP280)) {
+        failedReads++;
+        return;
+    }
+
+    WriteReadingFrame(CAPTURE_FRAME_BMP280, readAt, index, unit.bmp.cTemp, unit.bmp.pressure);
+}
+
+void StartCapture(uint32_t unixTime) {
+    if (isCapturing) {
+        return;
+    }
+
+    Serial.print("Capture starting at ");
+    Serial.print(CAPTURE_BAUD);
+    Serial.println(" baud");
+    Serial.flush();
+
+    // The transmit buffer can only be sized before the driver is installed
+    Serial.end();
+    Serial.setTxBufferSize(CAPTURE_TX_BUFFER_BYTES);
+    Serial.begin(CAPTURE_BAUD);
+
+    delay(CAPTURE_START_DELAY_MS);
+
+    sequence = 0;
+    framesDropped = 0;
+    failedReads = 0;
+    nextSht4xUnit = 0;
+    lastStatusAt = millis();
+
+    uint32_t startedAt = micros();
+    for (int i = 0; i < MAX_ENV_UNITS; i++) {
+        lastBmp280ReadAt[i] = startedAt - CAPTURE_BMP280_INTERVAL_US;
+    }
+
+    uint8_t payload[6];
+    payload[0] = CAPTURE_VERSION;
+    payload[1] = (uint8_t)GetEnvUnitCount();
+    PutUint32(&payload[2], unixTime);
+    WriteFrame(CAPTURE_FRAME_START, startedAt, payload, sizeof(payload));
+
+    isCapturing = true;
+}
+
+void StopCapture() {
+    if (!isCapturing) {
+        return;
+    }
+
+    isCapturing = false;
+
+    // Make room so the END frame isn't dropped
+    Serial.flush();
+    WriteStatusFrame(CAPTURE_FRAME_END);
+    Serial.flush();
+
+    // The transmit buffer is kept, as the driver won't take a size of none
+    Serial.end();
+    Serial.begin(CAPTURE_MONITOR_BAUD);
+
+    Serial.println();
+    Serial.print("Capture stopped after ");
+    Serial.print(sequence);
+    Serial.print(" frames, ");
+    Serial.print(framesDropped);
+    Serial.print(" dropped, ");
+    Serial.print(failedReads);
+    Serial.println(" failed reads");
+}
+
+bool IsCapturing() {
+    return isCapturing;
+}
+
+void UpdateCapture() {
+    if (!isCapturing) {
+        return;
+    }
+
+    int unitCount = GetEnvUnitCount();
+
+    for (int i = 0; i < unitCount; i++) {
+        uint32_t now = micros();
+        if (!GetEnvUnit(i).isBmp280Initialised || now - lastBmp280ReadAt[i] < CAPTURE_BMP280_INTERVAL_US) {
+            continue;
+        }
+
+        // Advanced by the interval so the time each call takes doesn't add up.
+        // If a whole interval has been missed it is skipped rather than read twice.
+        lastBmp280ReadAt[i] += CAPTURE_BMP280_INTERVAL_US;
+        if (now - lastBmp280ReadAt[i] >= CAPTURE_BMP280_INTERVAL_US) {
+            lastBmp280ReadAt[i] = now;
+        }
+
+        CaptureBmp280(i, now);
+    }
+
+    // Each SHT4x read waits 10ms for its conversion, so only one is read per call
+    // to keep the BMP280s on time
+    for (int checked = 0; checked < unitCount; checked++) {
+        int index = nextSht4xUnit;
+        nextSht4xUnit = (nextSht4xUnit + 1) % unitCount;
+
+        if (GetEnvUnit(index).isSht4xInitialised) {
+            CaptureSht4x(index);
+            break;
+        }
+    }
+
+    if (millis() - lastStatusAt >= CAPTURE_STATUS_INTERVAL_MS) {
+        lastStatusAt = millis();
+        WriteStatusFrame(CAPTURE_FRAME_STATUS);
+    }
+}
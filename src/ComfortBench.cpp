@@ -0,0 +1,97 @@
+#include "ComfortBench.h"
+
+#ifdef COMFORT_BENCH
+
+#include <math.h>
+
+#include <Arduino.h>
+#include <ComfortMetrics.h>
+
+#define COMFORT_BENCH_CALLS 10000
+#define COMFORT_BENCH_INPUTS 64
+
+// Each is timed this many times and the fastest kept, so an interrupt doesn't count
+#define COMFORT_BENCH_RUNS 5
+
+// The metrics as they would be written with libm
+static float LibmDewPoint(float temperature, float relativeHumidity) {
+    float gamma = logf(relativeHumidity / 100.0f) + (17.62f * temperature) / (243.12f + temperature);
+    return (243.12f * gamma) / (17.62f - gamma);
+}
+
+static float LibmAbsoluteHumidity(float temperature, float relativeHumidity) {
+    float saturationPressure = 6.112f * expf((17.62f * temperature) / (243.12f + temperature));
+    return 216.679f * (saturationPressure * relativeHumidity / 100.0f) / (273.15f + temperature);
+}
+
+static float LibmSeaLevelPressure(float pressure, float temperature, float altitude) {
+    float lapse = 0.0065f * altitude;
+    return pressure * powf(1.0f - lapse / (temperature + lapse + 273.15f), -5.257f);
+}
+
+static float inputs[COMFORT_BENCH_INPUTS];
+static float temperatures[COMFORT_BENCH_INPUTS];
+static float humidities[COMFORT_BENCH_INPUTS];
+
+// Cycles per call, less the loop's own cost
+template <typename Function>
+static uint32_t CyclesPerCall(const float* values, Function function) {
+    uint32_t fastest = UINT32_MAX;
+
+    for (int run = 0; run < COMFORT_BENCH_RUNS; run++) {
+        volatile float sink = 0.0f;
+
+        uint32_t startedAt = ESP.getCycleCount();
+        for (int i = 0; i < COMFORT_BENCH_CALLS; i++) {
+            sink = sink + function(values[i % COMFORT_BENCH_INPUTS]);
+        }
+        uint32_t cycles = ESP.getCycleCount() - startedAt;
+
+        fastest = min(fastest, cycles);
+    }
+
+    return fastest / COMFORT_BENCH_CALLS;
+}
+
+static void PrintComparison(const char* name, uint32_t overhead, uint32_t table, uint32_t libm) {
+    table = table > overhead ? table - overhead : 0;
+    libm = libm > overhead ? libm - overhead : 0;
+
+    Serial.printf("%-18s %8lu %8lu\n", name, (unsigned long)table, (unsigned long)libm);
+}
+
+void RunComfortBench() {
+    for (int i = 0; i < COMFORT_BENCH_INPUTS; i++) {
+        inputs[i] = 0.05f + i * 0.3f;
+        temperatures[i] = -10.0f + i * 0.7f;
+        humidities[i] = 10.0f + i * 1.4f;
+    }
+
+    uint32_t overhead = CyclesPerCall(inputs, [](float x) { return x; });
+
+    Serial.println("Comfort bench, cycles per call:");
+    Serial.printf("%-18s %8s %8s\n", "", "table", "libm");
+
+    PrintComparison("log", overhead,
+        CyclesPerCall(inputs, FastLog),
+        CyclesPerCall(inputs, logf));
+    PrintComparison("exp", overhead,
+        CyclesPerCall(inputs, [](float x) { return FastExp(x * 0.1f); }),
+        CyclesPerCall(inputs, [](float x) { return expf(x * 0.1f); }));
+    PrintComparison("pow", overhead,
+        CyclesPerCall(inputs, [](float x) { return FastPow(x, -5.257f); }),
+        CyclesPerCall(inputs, [](float x) { return powf(x, -5.257f); }));
+
+    // The index picks a temperature and humidity, so both vary
+    PrintComparison("dew point", overhead,
+        CyclesPerCall(inputs, [](float x) { int i = (int)x % COMFORT_BENCH_INPUTS; return CalculateDewPoint(temperatures[i], humidities[i]); }),
+        CyclesPerCall(inputs, [](float x) { int i = (int)x % COMFORT_BENCH_INPUTS; return LibmDewPoint(temperatures[i], humidities[i]); }));
+    PrintComparison("absolute humidity", overhead,
+        CyclesPerCall(inputs, [](float x) { int i = (int)x % COMFORT_BENCH_INPUTS; return CalculateAbsoluteHumidity(temperatures[i], humidities[i]); }),
+        CyclesPerCall(inputs, [](float x) { int i = (int)x % COMFORT_BENCH_INPUTS; return LibmAbsoluteHumidity(temperatures[i], humidities[i]); }));
+    PrintComparison("sea level pressure", overhead,
+        CyclesPerCall(inputs, [](float x) { return CalculateSeaLevelPressure(101325.0f, x, 120.0f); }),
+        CyclesPerCall(inputs, [](float x) { return LibmSeaLevelPressure(101325.0f, x, 120.0f); }));
+}
+
+#endif
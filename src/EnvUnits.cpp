@@ -0,0 +1,413 @@
+#include "EnvUnits.h"
+
+#include <Arduino.h>
+#include <Trace.h>
+#include <Wire.h>
+
+#include "Recorder.h"
+
+static uint8_t sdaPin;
+static uint8_t sclPin;
+
+static EnvUnit envUnits[MAX_ENV_UNITS];
+static int envUnitCount = 0;
+
+static uint8_t selectedHubAddress = ENV_UNIT_DIRECT;
+static uint8_t selectedHubChannel = 0;
+
+static unsigned int updateCount = 0;
+static uint32_t lastReadMicros = 0;
+
+static SensorPrecision sensorPrecision = SENSOR_PRECISION_HIGH;
+static bool isCaptureSampling = false;
+
+static bool IsDevicePresent(uint8_t address) {
+    Wire.beginTransmission(address);
+    return Wire.endTransmission() == 0;
+}
+
+static bool WriteHubChannelMask(uint8_t hubAddress, uint8_t channelMask) {
+    Wire.beginTransmission(hubAddress);
+    Wire.write(channelMask);
+    return Wire.endTransmission() == 0;
+}
+
+// Switches the hubs only if the unit isn't already selected.
+// Returns false if the switch failed, when reading would reach whichever channel is still open.
+static bool SelectUnit(const EnvUnit& unit) {
+    if (unit.hubAddress == ENV_UNIT_DIRECT) {
+        return true;
+    }
+
+    if (selectedHubAddress == unit.hubAddress && selectedHubChannel == unit.hubChannel) {
+        return true;
+    }
+
+    TRACE_SCOPE("SelectUnit");
+
+    // Only one hub may have a channel open, or units behind different hubs would clash
+    if (selectedHubAddress != ENV_UNIT_DIRECT && selectedHubAddress != unit.hubAddress) {
+        if (!WriteHubChannelMask(selectedHubAddress, 0)) {
+            return false;
+        }
+    }
+
+    if (!WriteHubChannelMask(unit.hubAddress, 1 << unit.hubChannel)) {
+        // Force a fresh switch next time
+        selectedHubAddress = ENV_UNIT_DIRECT;
+        return false;
+    }
+
+    selectedHubAddress = unit.hubAddress;
+    selectedHubChannel = unit.hubChannel;
+
+    return true;
+}
+
+static void PrintUnitLabel(const EnvUnit& unit) {
+    Serial.print("[");
+    Serial.print(unit.label);
+    Serial.print("] ");
+}
+
+static void ApplySht4xPrecision(EnvUnit& unit) {
+    // The driver waits 10ms per read at high precision, 2ms at low
+    if (isCaptureSampling || sensorPrecision == SENSOR_PRECISION_HIGH) {
+        unit.sht4.setPrecision(SHT4X_HIGH_PRECISION);
+    } else if (sensorPrecision == SENSOR_PRECISION_MEDIUM) {
+        unit.sht4.setPrecision(SHT4X_MED_PRECISION);
+    } else {
+        unit.sht4.setPrecision(SHT4X_LOW_PRECISION);
+    }
+}
+
+static void ApplyBmp280Precision(EnvUnit& unit) {
+    if (isCaptureSampling) {
+        // A new conversion every ~44ms, each one unfiltered
+        unit.bmp.setSampling(
+            BMP280::MODE_NORMAL,
+            BMP280::SAMPLING_X2,
+            BMP280::SAMPLING_X16,
+            BMP280::FILTER_OFF,
+            BMP280::STANDBY_MS_1
+        );
+    } else if (sensorPrecision == SENSOR_PRECISION_HIGH) {
+        /* Default settings from datasheet. */
+        unit.bmp.setSampling(
+            // Operating Mode.
+            BMP280::MODE_NORMAL,
+            // Temp. oversampling.
+            BMP280::SAMPLING_X2,
+            // Pressure oversampling.
+            BMP280::SAMPLING_X16,
+            // Filtering.
+            BMP280::FILTER_X16,
+            // Standby time.
+            BMP280::STANDBY_MS_500
+        );
+    } else if (sensorPrecision == SENSOR_PRECISION_MEDIUM) {
+        unit.bmp.setSampling(
+            BMP280::MODE_NORMAL,
+            BMP280::SAMPLING_X1,
+            BMP280::SAMPLING_X4,
+            BMP280::FILTER_X4,
+            BMP280::STANDBY_MS_2000
+        );
+    } else {
+        unit.bmp.setSampling(
+            BMP280::MODE_NORMAL,
+            BMP280::SAMPLING_X1,
+            BMP280::SAMPLING_X1,
+            BMP280::FILTER_OFF,
+            BMP280::STANDBY_MS_4000
+        );
+    }
+}
+
+static bool TryInitialiseSht4x(EnvUnit& unit) {
+    PrintUnitLabel(unit);
+
+    if (!unit.sht4.begin(&Wire, SHT40_I2C_ADDR_44, sdaPin, sclPin, 400000U)) {
+        Serial.println("Couldn't find SHT4x sensor");
+
+        return false;
+    }
+
+    Serial.println("Found SHT4x sensor");
+
+    ApplySht4xPrecision(unit);
+    unit.sht4.setHeater(SHT4X_NO_HEATER);
+
+    return true;
+}
+
+static bool TryInitialiseBmp280(EnvUnit& unit) {
+    PrintUnitLabel(unit);
+
+    if (!unit.bmp.begin(&Wire, BMP280_I2C_ADDR, sdaPin, sclPin, 400000U)) {
+        Serial.println("Couldn't find BMP280 sensor");
+
+        return false;
+    }
+
+    Serial.println("Found BMP280 sensor");
+
+    ApplyBmp280Precision(unit);
+
+    return true;
+}
+
+static bool TryInitialiseScd4x(EnvUnit& unit) {
+    PrintUnitLabel(unit);
+
+    if (!unit.scd4.begin(&Wire, SCD4X_I2C_ADDR, sdaPin, sclPin, 400000U)) {
+        Serial.println("Couldn't find SCD4X");
+        return false;
+    }
+
+    // stop potentially previously started measurement
+    if (unit.scd4.stopPeriodicMeasurement()) {
+        Serial.print("Error trying to execute stopPeriodicMeasurement()");
+        Serial.println();
+    }
+
+    // Start Measurement
+    if (unit.scd4.startPeriodicMeasurement()) {
+        Serial.print("Error trying to execute startPeriodicMeasurement()");
+        Serial.println();
+    }
+
+    Serial.println("Waiting for first measurement... (5 sec)");
+
+    return true;
+}
+
+// Only sensors which acknowledge their address are initialised,
+// so empty channels cost one probe per sensor
+static void InitialiseMissingSensors(EnvUnit& unit) {
+    TRACE_SCOPE("InitialiseMissingSensors");
+
+    if (!unit.isBmp280Initialised && IsDevicePresent(BMP280_I2C_ADDR)) {
+        unit.isBmp280Initialised = TryInitialiseBmp280(unit);
+    }
+
+    if (!unit.isSht4xInitialised && IsDevicePresent(SHT40_I2C_ADDR_44)) {
+        unit.isSht4xInitialised = TryInitialiseSht4x(unit);
+    }
+
+    if (!unit.isScd4xInitialised && IsDevicePresent(SCD4X_I2C_ADDR)) {
+        unit.isScd4xInitialised = TryInitialiseScd4x(unit);
+    }
+}
+
+static void HandleSensorLost(EnvUnit& unit, int unitIndex, RecordingSensor sensor) {
+    PrintUnitLabel(unit);
+
+    if (sensor == RECORDING_SENSOR_SHT4X) {
+        Serial.println("Lost SHT4x sensor");
+        unit.isSht4xInitialised = false;
+    } else if (sensor == RECORDING_SENSOR_BMP280) {
+        Serial.println("Lost BMP280 sensor");
+        unit.isBmp280Initialised = false;
+    } else if (sensor == RECORDING_SENSOR_SCD4X) {
+        Serial.println("Lost SCD4X sensor");
+        unit.isScd4xInitialised = false;
+    }
+
+    RecordI2cError(unitIndex, sensor);
+}
+
+void BeginEnvUnits(uint8_t sda, uint8_t scl) {
+    TRACE_SCOPE("BeginEnvUnits");
+
+    sdaPin = sda;
+    sclPin = scl;
+
+    Wire.begin(sdaPin, sclPin, 400000U);
+
+    envUnitCount = 0;
+
+    for (int hub = 0; hub < PAHUB_MAX_COUNT; hub++) {
+        uint8_t hubAddress = PAHUB_I2C_ADDR + hub;
+        if (!IsDevicePresent(hubAddress)) {
+            continue;
+        }
+
+        Serial.print("Found I2C hub at 0x");
+        Serial.println(hubAddress, HEX);
+
+        WriteHubChannelMask(hubAddress, 0);
+
+        for (int channel = 0; channel < PAHUB_CHANNEL_COUNT; channel++) {
+            EnvUnit& unit = envUnits[envUnitCount++];
+            unit.hubAddress = hubAddress;
+            unit.hubChannel = channel;
+            unit.channel = hub * PAHUB_CHANNEL_COUNT + channel;
+            snprintf(unit.label, sizeof(unit.label), "%d", unit.channel);
+        }
+    }
+
+    if (envUnitCount == 0) {
+        Serial.println("No I2C hub found; using the main bus");
+
+        EnvUnit& unit = envUnits[envUnitCount++];
+        unit.hubAddress = ENV_UNIT_DIRECT;
+        unit.hubChannel = 0;
+        unit.channel = 0;
+        snprintf(unit.label, sizeof(unit.label), "bus");
+    }
+
+    for (int i = 0; i < envUnitCount; i++) {
+        if (SelectUnit(envUnits[i])) {
+            InitialiseMissingSensors(envUnits[i]);
+        }
+    }
+}
+
+void UpdateEnvUnits() {
+    TRACE_SCOPE("UpdateEnvUnits");
+
+    uint32_t startedAt = micros();
+
+    bool isDiscoveryLoop = (updateCount++ % ENV_DISCOVERY_INTERVAL_LOOPS) == 0;
+
+    for (int i = 0; i < envUnitCount; i++) {
+        EnvUnit& unit = envUnits[i];
+
+        // The main bus is always retried, matching a single unit setup.
+        // Hub channels are only retried occasionally so empty ones cost nothing.
+        bool shouldDiscover = isDiscoveryLoop || unit.hubAddress == ENV_UNIT_DIRECT;
+
+        if (!HasAnySensorInitialised(unit) && !shouldDiscover) {
+            unit.readMicros = 0;
+            continue;
+        }
+
+        uint32_t unitStartedAt = micros();
+
+        // Skipped this loop rather than storing another channel's readings as this unit's
+        unit.isSelectFailed = !SelectUnit(unit);
+        if (unit.isSelectFailed) {
+            unit.readMicros = 0;
+            continue;
+        }
+
+        // A sensor which stops acknowledging has been unplugged.
+        // It is dropped and picked up again by discovery when it returns.
+        if (unit.isBmp280Initialised) {
+            TRACE_SCOPE("bmp.update");
+
+            if (IsDevicePresent(BMP280_I2C_ADDR)) {
+                unit.bmp.update();
+            } else {
+                HandleSensorLost(unit, i, RECORDING_SENSOR_BMP280);
+            }
+        }
+
+        if (unit.isSht4xInitialised) {
+            TRACE_SCOPE("sht4.update");
+
+            // update() also fails on a CRC mismatch
+            if (!IsDevicePresent(SHT40_I2C_ADDR_44) || !unit.sht4.update()) {
+                HandleSensorLost(unit, i, RECORDING_SENSOR_SHT4X);
+            }
+        }
+
+        if (unit.isScd4xInitialised) {
+            TRACE_SCOPE("scd4.update");
+
+            // update() returning false only means there is no new measurement yet
+            if (IsDevicePresent(SCD4X_I2C_ADDR)) {
+                unit.scd4.update();
+            } else {
+                HandleSensorLost(unit, i, RECORDING_SENSOR_SCD4X);
+            }
+        }
+
+        if (shouldDiscover) {
+            InitialiseMissingSensors(unit);
+        }
+
+        unit.readMicros = micros() - unitStartedAt;
+    }
+
+    lastReadMicros = micros() - startedAt;
+}
+
+int GetEnvUnitCount() {
+    return envUnitCount;
+}
+
+EnvUnit& GetEnvUnit(int index) {
+    return envUnits[index];
+}
+
+EnvUnit* GetPrimaryEnvUnit() {
+    for (int i = 0; i < envUnitCount; i++) {
+        if (HasAnySensorInitialised(envUnits[i])) {
+            return &envUnits[i];
+        }
+    }
+
+    return nullptr;
+}
+
+bool HasAnySensorInitialised(const EnvUnit& unit) {
+    return unit.isSht4xInitialised || unit.isBmp280Initialised || unit.isScd4xInitialised;
+}
+
+uint32_t GetEnvUnitsReadMicros() {
+    return lastReadMicros;
+}
+
+void SetEnvUnitsPrecision(SensorPrecision precision) {
+    sensorPrecision = precision;
+
+    for (int i = 0; i < envUnitCount; i++) {
+        EnvUnit& unit = envUnits[i];
+
+        if (!unit.isSht4xInitialised && !unit.isBmp280Initialised) {
+            continue;
+        }
+
+        if (!SelectUnit(unit)) {
+            continue;
+        }
+
+        if (unit.isSht4xInitialised) {
+            ApplySht4xPrecision(unit);
+        }
+
+        if (unit.isBmp280Initialised) {
+            ApplyBmp280Precision(unit);
+        }
+    }
+}
+
+void SetEnvUnitsCaptureSampling(bool isCapturing) {
+    isCaptureSampling = isCapturing;
+    SetEnvUnitsPrecision(sensorPrecision);
+}
+
+bool ReadEnvUnitSensor(int index, RecordingSensor sensor) {
+    EnvUnit& unit = envUnits[index];
+
+    if (!SelectUnit(unit)) {
+        return false;
+    }
+
+    if (sensor == RECORDING_SENSOR_SHT4X) {
+        return IsDevicePresent(SHT40_I2C_ADDR_44) && unit.sht4.update();
+    }
+
+    if (sensor == RECORDING_SENSOR_BMP280) {
+        if (!IsDevicePresent(BMP280_I2C_ADDR)) {
+            return false;
+        }
+
+        unit.bmp.update();
+        return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,247 @@
+#include "History.h"
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <Trace.h>
+
+static String GetChunkPath(uint32_t sequence) {
+    char path[32];
+    snprintf(path, sizeof(path), HISTORY_DIRECTORY "/%08lx.bin", (unsigned long)sequence);
+    return String(path);
+}
+
+static bool Overlaps(const HistoryChunkHeader& header, uint32_t from, uint32_t to) {
+    return header.sampleCount > 0 && header.firstTimestamp <= to && header.lastTimestamp >= from;
+}
+
+// ========
+// Store
+// ========
+
+HistoryStore::HistoryStore()
+    : isMounted(false), activeChunk(activeBuffer, sizeof(activeBuffer)),
+      ramChunkCount(0), firstSequence(0), nextSequence(0), lastTimestamp(0) {
+}
+
+bool HistoryStore::Begin() {
+    TRACE_SCOPE("HistoryStore::Begin");
+
+    if (!LittleFS.begin(true)) {
+        Serial.println("Failed to mount LittleFS; history will be kept in RAM only");
+        return false;
+    }
+
+    isMounted = true;
+
+    if (!LittleFS.exists(HISTORY_DIRECTORY)) {
+        LittleFS.mkdir(HISTORY_DIRECTORY);
+    }
+
+    // Find the range of sequence numbers left by the previous boot
+    bool hasFiles = false;
+    uint32_t lowest = 0;
+    uint32_t highest = 0;
+
+    File directory = LittleFS.open(HISTORY_DIRECTORY);
+    File file = directory.openNextFile();
+    while (file) {
+        uint32_t sequence = strtoul(file.name(), nullptr, 16);
+
+        if (!hasFiles || sequence < lowest) lowest = sequence;
+        if (!hasFiles || sequence > highest) highest = sequence;
+        hasFiles = true;
+
+        file.close();
+        file = directory.openNextFile();
+    }
+    directory.close();
+
+    if (hasFiles) {
+        firstSequence = lowest;
+        nextSequence = highest + 1;
+
+        // New samples must follow the newest stored one
+        File newest = LittleFS.open(GetChunkPath(highest), FILE_READ);
+        HistoryChunkHeader header;
+        if (newest && newest.read((uint8_t*)&header, sizeof(header)) == sizeof(header)
+            && header.magic == HISTORY_CHUNK_MAGIC) {
+            lastTimestamp = header.lastTimestamp;
+        }
+        newest.close();
+    }
+
+    Serial.print("History chunks on flash: ");
+    Serial.println(nextSequence - firstSequence);
+
+    return true;
+}
+
+void HistoryStore::Append(const HistorySample& sample) {
+    if (sample.timestamp <= lastTimestamp) {
+        // The clock has gone backwards; drop the sample rather than break the ordering.
+        // Checked against every stored chunk, not just the active one, as a new chunk
+        // after a flush must still start after the last.
+        return;
+    }
+
+    lastTimestamp = sample.timestamp;
+
+    if (activeChunk.Append(sample)) {
+        return;
+    }
+
+    // The active chunk is full - queue it
+    if (ramChunkCount == HISTORY_RAM_CHUNKS) {
+        Flush(false);
+    }
+
+    if (ramChunkCount < HISTORY_RAM_CHUNKS) {
+        ramHeaders[ramChunkCount] = activeChunk.Header();
+        memcpy(ramBuffers[ramChunkCount], activeChunk.Data(), activeChunk.SizeBytes());
+        ramChunkCount++;
+    }
+
+    activeChunk.Reset();
+    activeChunk.Append(sample);
+}
+
+void HistoryStore::Flush(bool includeActive) {
+    TRACE_SCOPE("HistoryStore::Flush");
+
+    if (!isMounted) {
+        // Nowhere to put them; discard the oldest so there is room to queue
+        if (ramChunkCount == HISTORY_RAM_CHUNKS) {
+            for (int i = 1; i < ramChunkCount; i++) {
+                ramHeaders[i - 1] = ramHeaders[i];
+                memcpy(ramBuffers[i - 1], ramBuffers[i], HISTORY_CHUNK_BYTES);
+            }
+            ramChunkCount--;
+        }
+        return;
+    }
+
+    for (int i = 0; i < ramChunkCount; i++) {
+        WriteChunk(ramHeaders[i], ramBuffers[i]);
+    }
+    ramChunkCount = 0;
+
+    if (includeActive && !activeChunk.IsEmpty()) {
+        WriteChunk(activeChunk.Header(), activeChunk.Data());
+        activeChunk.Reset();
+    }
+}
+
+bool HistoryStore::WriteChunk(const HistoryChunkHeader& header, const uint8_t* data) {
+    while (nextSequence - firstSequence >= HISTORY_MAX_FILES) {
+        DeleteOldestChunk();
+    }
+
+    File file = LittleFS.open(GetChunkPath(nextSequence), FILE_WRITE);
+    if (!file) {
+        Serial.println("Failed to open history chunk for writing");
+        return false;
+    }
+
+    size_t dataBytes = (header.bitLength + 7) / 8;
+    bool isWritten = file.write((const uint8_t*)&header, sizeof(header)) == sizeof(header)
+        && file.write(data, dataBytes) == dataBytes;
+    file.close();
+
+    if (!isWritten) {
+        Serial.println("Failed to write history chunk");
+        LittleFS.remove(GetChunkPath(nextSequence));
+        return false;
+    }
+
+    nextSequence++;
+
+    return true;
+}
+
+void HistoryStore::DeleteOldestChunk() {
+    LittleFS.remove(GetChunkPath(firstSequence));
+    firstSequence++;
+}
+
+// ========
+// Query
+// ========
+
+HistoryQuery::HistoryQuery(HistoryStore& store, uint32_t from, uint32_t to)
+    : store(store), from(from), to(to),
+      nextFileSequence(store.firstSequence), nextRamChunk(0), hasReadActiveChunk(false) {
+}
+
+bool HistoryQuery::Next(HistorySample& sample) {
+    while (true) {
+        while (decoder.Next(sample)) {
+            if (sample.timestamp > to) {
+                // Everything after this is later still
+                return false;
+            }
+
+            if (sample.timestamp >= from) {
+                return true;
+            }
+        }
+
+        if (!LoadNextChunk()) {
+            return false;
+        }
+    }
+}
+
+bool HistoryQuery::LoadNextChunk() {
+    // Flushing during a query may have rotated files away
+    if (nextFileSequence < store.firstSequence) {
+        nextFileSequence = store.firstSequence;
+    }
+
+    while (store.isMounted && nextFileSequence < store.nextSequence) {
+        File file = LittleFS.open(GetChunkPath(nextFileSequence++), FILE_READ);
+        if (!file) {
+            continue;
+        }
+
+        bool isValid = file.read((uint8_t*)&header, sizeof(header)) == sizeof(header)
+            && header.magic == HISTORY_CHUNK_MAGIC
+            && header.bitLength <= HISTORY_CHUNK_BYTES * 8;
+
+        if (isValid && Overlaps(header, from, to)) {
+            size_t dataBytes = (header.bitLength + 7) / 8;
+            isValid = file.read(buffer, dataBytes) == dataBytes;
+            file.close();
+
+            if (isValid) {
+                decoder.Reset(header, buffer);
+                return true;
+            }
+            continue;
+        }
+
+        file.close();
+    }
+
+    while (nextRamChunk < store.ramChunkCount) {
+        int index = nextRamChunk++;
+        if (Overlaps(store.ramHeaders[index], from, to)) {
+            header = store.ramHeaders[index];
+            memcpy(buffer, store.ramBuffers[index], (header.bitLength + 7) / 8);
+            decoder.Reset(header, buffer);
+            return true;
+        }
+    }
+
+    if (!hasReadActiveChunk) {
+        hasReadActiveChunk = true;
+
+        if (Overlaps(store.activeChunk.Header(), from, to)) {
+            header = store.activeChunk.Header();
+            memcpy(buffer, store.activeChunk.Data(), store.activeChunk.SizeBytes());
+            decoder.Reset(header, buffer);
+            return true;
+        }
+    }
+
+    return false;
+}
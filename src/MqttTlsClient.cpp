@@ -0,0 +1,409 @@
+#include "MqttTlsClient.h"
+
+#include <string.h>
+#include <time.h>
+
+#include <Arduino.h>
+#include <Trace.h>
+
+#include <mbedtls/error.h>
+#include <mbedtls/net_sockets.h>
+
+#define MQTT_TLS_PERSONALISATION "thermo_iot"
+
+// Kept over deep sleep, cleared by a reset or power loss
+RTC_DATA_ATTR static uint8_t rtcSession[MQTT_TLS_RTC_SESSION_BYTES];
+RTC_DATA_ATTR static uint32_t rtcSessionLength = 0;
+
+MqttTlsClient::MqttTlsClient(WiFiClient& transport)
+    : transport(transport), isBegun(false), isConnected(false), hasSession(false),
+      hasVerifiedCertificate(false), handshakeMinFreeHeap(0), peekedByte(-1) {
+    memset(&stats, 0, sizeof(stats));
+
+    mbedtls_entropy_init(&entropy);
+    mbedtls_ctr_drbg_init(&random);
+    mbedtls_x509_crt_init(&caChain);
+    mbedtls_ssl_config_init(&config);
+    mbedtls_ssl_init(&ssl);
+    mbedtls_ssl_session_init(&session);
+}
+
+bool MqttTlsClient::Begin(const char* caCert) {
+    TRACE_SCOPE("MqttTlsClient::Begin");
+
+    int error = mbedtls_ctr_drbg_seed(&random, mbedtls_entropy_func, &entropy,
+        (const unsigned char*)MQTT_TLS_PERSONALISATION, strlen(MQTT_TLS_PERSONALISATION));
+    if (error != 0) {
+        OnError("seeding", error);
+        return false;
+    }
+
+    // The length includes the null terminator for PEM
+    error = mbedtls_x509_crt_parse(&caChain, (const unsigned char*)caCert, strlen(caCert) + 1);
+    if (error != 0) {
+        OnError("parsing the CA certificate", error);
+        return false;
+    }
+
+    error = mbedtls_ssl_config_defaults(&config, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT);
+    if (error != 0) {
+        OnError("configuring", error);
+        return false;
+    }
+
+    mbedtls_ssl_conf_authmode(&config, MBEDTLS_SSL_VERIFY_REQUIRED);
+    mbedtls_ssl_conf_ca_chain(&config, &caChain, nullptr);
+    mbedtls_ssl_conf_rng(&config, mbedtls_ctr_drbg_random, &random);
+    mbedtls_ssl_conf_verify(&config, VerifyCertificate, this);
+
+#ifdef MBEDTLS_SSL_MAX_FRAGMENT_LENGTH
+    mbedtls_ssl_conf_max_frag_len(&config, MQTT_TLS_MAX_FRAGMENT_LENGTH);
+#endif
+
+#ifdef MBEDTLS_SSL_SESSION_TICKETS
+    mbedtls_ssl_conf_session_tickets(&config, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+
+    isBegun = true;
+
+    hasSession = LoadSession();
+    if (hasSession) {
+        Serial.println("Restored TLS session from before deep sleep");
+    }
+
+    return true;
+}
+
+bool MqttTlsClient::IsClockValid() {
+    return time(nullptr) >= MQTT_TLS_MIN_VALID_TIME;
+}
+
+int MqttTlsClient::connect(IPAddress ip, uint16_t port) {
+    Serial.println("TLS needs the broker's host name to verify its certificate, not an address");
+    return 0;
+}
+
+int MqttTlsClient::connect(const char* host, uint16_t port) {
+    if (!isBegun) {
+        return 0;
+    }
+
+    if (!IsClockValid()) {
+        Serial.println("Not connecting over TLS until the clock is set");
+        return 0;
+    }
+
+    stop();
+
+    if (!transport.connect(host, port)) {
+        return 0;
+    }
+
+    if (!Handshake(host)) {
+        stats.failures++;
+        transport.stop();
+        return 0;
+    }
+
+    isConnected = true;
+    return 1;
+}
+
+bool MqttTlsClient::Handshake(const char* host) {
+    TRACE_SCOPE("MqttTlsClient::Handshake");
+
+    uint32_t freeHeapBefore = ESP.getFreeHeap();
+    handshakeMinFreeHeap = freeHeapBefore;
+    uint32_t startedAt = micros();
+
+    int error = mbedtls_ssl_setup(&ssl, &config);
+    if (error == 0) {
+        error = mbedtls_ssl_set_hostname(&ssl, host);
+    }
+    if (error != 0) {
+        OnError("setting up", error);
+        mbedtls_ssl_free(&ssl);
+        mbedtls_ssl_init(&ssl);
+        return false;
+    }
+
+    mbedtls_ssl_set_bio(&ssl, this, SendToTransport, ReceiveFromTransport, nullptr);
+
+    // If the broker no longer has the session this falls back to a full handshake
+    bool isResuming = hasSession && mbedtls_ssl_set_session(&ssl, &session) == 0;
+    hasVerifiedCertificate = false;
+
+    unsigned long startedAtMillis = millis();
+    while ((error = mbedtls_ssl_handshake(&ssl)) != 0) {
+        bool isWaiting = error == MBEDTLS_ERR_SSL_WANT_READ || error == MBEDTLS_ERR_SSL_WANT_WRITE;
+        if (isWaiting && millis() - startedAtMillis > MQTT_TLS_TIMEOUT_MS) {
+            error = MBEDTLS_ERR_SSL_TIMEOUT;
+            isWaiting = false;
+        }
+
+        if (!isWaiting) {
+            OnError("handshake", error);
+
+            mbedtls_ssl_free(&ssl);
+            mbedtls_ssl_init(&ssl);
+
+            // Don't keep offering a session which may be the problem
+            if (isResuming) {
+                ClearSession();
+            }
+            return false;
+        }
+
+        delay(1);
+    }
+
+    uint32_t elapsedMicros = micros() - startedAt;
+
+    bool isResumed = isResuming && !hasVerifiedCertificate;
+    TlsHandshakeStats& handshakeStats = isResumed ? stats.resumed : stats.full;
+
+    handshakeStats.count++;
+    handshakeStats.lastMicros = elapsedMicros;
+    handshakeStats.totalMicros += elapsedMicros;
+    handshakeStats.lastHeapBytes = (int32_t)freeHeapBefore - (int32_t)ESP.getFreeHeap();
+    handshakeStats.lastMinFreeHeap = handshakeMinFreeHeap;
+
+    Serial.print(isResumed ? "Resumed TLS session in " : "Full TLS handshake in ");
+    Serial.print(elapsedMicros);
+    Serial.print("us, holding ");
+    Serial.print(handshakeStats.lastHeapBytes);
+    Serial.println(" bytes of heap");
+
+    // The broker may have issued a new ticket
+    SaveSession();
+
+    return true;
+}
+
+size_t MqttTlsClient::write(uint8_t value) {
+    return write(&value, 1);
+}
+
+size_t MqttTlsClient::write(const uint8_t* buffer, size_t size) {
+    if (!isConnected) {
+        return 0;
+    }
+
+    size_t written = 0;
+    unsigned long startedAt = millis();
+
+    while (written < size) {
+        int result = mbedtls_ssl_write(&ssl, buffer + written, size - written);
+
+        if (result > 0) {
+            written += result;
+            continue;
+        }
+
+        if (result != MBEDTLS_ERR_SSL_WANT_READ && result != MBEDTLS_ERR_SSL_WANT_WRITE) {
+            OnError("write", result);
+            stop();
+            break;
+        }
+
+        if (millis() - startedAt > MQTT_TLS_TIMEOUT_MS) {
+            Serial.println("TLS write timed out");
+            break;
+        }
+
+        delay(1);
+    }
+
+    return written;
+}
+
+int MqttTlsClient::available() {
+    int peeked = peekedByte >= 0 ? 1 : 0;
+
+    if (!isConnected) {
+        return peeked;
+    }
+
+    // Processes any record waiting on the socket without consuming its data
+    int result = mbedtls_ssl_read(&ssl, nullptr, 0);
+    if (result < 0 && result != MBEDTLS_ERR_SSL_WANT_READ && result != MBEDTLS_ERR_SSL_WANT_WRITE) {
+        if (result != MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) {
+            OnError("read", result);
+        }
+        stop();
+        return peeked;
+    }
+
+    return peeked + mbedtls_ssl_get_bytes_avail(&ssl);
+}
+
+int MqttTlsClient::read() {
+    uint8_t value;
+    return read(&value, 1) == 1 ? value : -1;
+}
+
+int MqttTlsClient::read(uint8_t* buffer, size_t size) {
+    if (size == 0) {
+        return 0;
+    }
+
+    size_t offset = 0;
+    if (peekedByte >= 0) {
+        buffer[0] = (uint8_t)peekedByte;
+        peekedByte = -1;
+        offset = 1;
+    }
+
+    if (offset == size || !isConnected) {
+        return offset > 0 ? (int)offset : -1;
+    }
+
+    int result = mbedtls_ssl_read(&ssl, buffer + offset, size - offset);
+    if (result > 0) {
+        return offset + result;
+    }
+
+    // 0 is the end of the stream
+    if (result != MBEDTLS_ERR_SSL_WANT_READ && result != MBEDTLS_ERR_SSL_WANT_WRITE) {
+        if (result != 0 && result != MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) {
+            OnError("read", result);
+        }
+        stop();
+    }
+
+    return offset > 0 ? (int)offset : -1;
+}
+
+int MqttTlsClient::peek() {
+    if (peekedByte < 0) {
+        uint8_t value;
+        if (read(&value, 1) == 1) {
+            peekedByte = value;
+        }
+    }
+
+    return peekedByte;
+}
+
+void MqttTlsClient::flush() {
+    // Writes are sent as they are made.
+    // WiFiClient::flush would discard incoming data, so it isn't passed on.
+}
+
+void MqttTlsClient::stop() {
+    if (isConnected) {
+        mbedtls_ssl_close_notify(&ssl);
+    }
+
+    // Frees the record buffers between connections; the session is kept
+    mbedtls_ssl_free(&ssl);
+    mbedtls_ssl_init(&ssl);
+
+    transport.stop();
+
+    isConnected = false;
+    peekedByte = -1;
+}
+
+uint8_t MqttTlsClient::connected() {
+    if (isConnected && !transport.connected()) {
+        stop();
+    }
+
+    return isConnected;
+}
+
+void MqttTlsClient::ClearSession() {
+    mbedtls_ssl_session_free(&session);
+    mbedtls_ssl_session_init(&session);
+
+    hasSession = false;
+    rtcSessionLength = 0;
+}
+
+void MqttTlsClient::SaveSession() {
+    mbedtls_ssl_session_free(&session);
+    mbedtls_ssl_session_init(&session);
+
+    hasSession = mbedtls_ssl_get_session(&ssl, &session) == 0;
+    rtcSessionLength = 0;
+
+    if (!hasSession) {
+        return;
+    }
+
+    size_t length;
+    if (mbedtls_ssl_session_save(&session, rtcSession, sizeof(rtcSession), &length) == 0) {
+        rtcSessionLength = length;
+    }
+}
+
+bool MqttTlsClient::LoadSession() {
+    if (rtcSessionLength == 0) {
+        return false;
+    }
+
+    if (mbedtls_ssl_session_load(&session, rtcSession, rtcSessionLength) != 0) {
+        ClearSession();
+        return false;
+    }
+
+    return true;
+}
+
+void MqttTlsClient::OnError(const char* operation, int error) {
+    stats.lastError = error;
+
+    char description[96];
+    mbedtls_strerror(error, description, sizeof(description));
+
+    Serial.print("TLS ");
+    Serial.print(operation);
+    Serial.print(" failed: -0x");
+    Serial.print(-error, HEX);
+    Serial.print(' ');
+    Serial.println(description);
+}
+
+int MqttTlsClient::SendToTransport(void* context, const unsigned char* buffer, size_t length) {
+    MqttTlsClient* client = (MqttTlsClient*)context;
+
+    client->handshakeMinFreeHeap = min(client->handshakeMinFreeHeap, ESP.getFreeHeap());
+
+    if (!client->transport.connected()) {
+        return MBEDTLS_ERR_NET_CONN_RESET;
+    }
+
+    size_t written = client->transport.write(buffer, length);
+    if (written == 0) {
+        return MBEDTLS_ERR_SSL_WANT_WRITE;
+    }
+
+    return written;
+}
+
+int MqttTlsClient::ReceiveFromTransport(void* context, unsigned char* buffer, size_t length) {
+    MqttTlsClient* client = (MqttTlsClient*)context;
+
+    client->handshakeMinFreeHeap = min(client->handshakeMinFreeHeap, ESP.getFreeHeap());
+
+    if (client->transport.available() <= 0) {
+        return client->transport.connected() ? MBEDTLS_ERR_SSL_WANT_READ : MBEDTLS_ERR_NET_CONN_RESET;
+    }
+
+    int result = client->transport.read(buffer, length);
+    if (result <= 0) {
+        return MBEDTLS_ERR_SSL_WANT_READ;
+    }
+
+    return result;
+}
+
+// Only records that a certificate was seen; connect has made sure the clock can be used
+// to check its dates, so mbedTLS's own checks are left as they are
+int MqttTlsClient::VerifyCertificate(void* context, mbedtls_x509_crt* certificate, int depth, uint32_t* flags) {
+    MqttTlsClient* client = (MqttTlsClient*)context;
+    client->hasVerifiedCertificate = true;
+
+    return 0;
+}
@@ -0,0 +1,184 @@
+#include "Recorder.h"
+
+#include <Arduino.h>
+#include <LittleFS.h>
+
+#define RECORDER_BUFFER_BYTES 512
+
+static RecordingWriter recordingWriter;
+static bool isRecording = false;
+
+static uint8_t recorderBuffer[RECORDER_BUFFER_BYTES];
+static size_t recorderBufferLength = 0;
+static uint32_t recordedBytes = 0;
+
+static void FlushRecorderBuffer() {
+    if (recorderBufferLength == 0) {
+        return;
+    }
+
+    File file = LittleFS.open(RECORDING_PATH, FILE_APPEND);
+    if (!file) {
+        Serial.println("Failed to open recording; stopping");
+        isRecording = false;
+        recorderBufferLength = 0;
+        return;
+    }
+
+    file.write(recorderBuffer, recorderBufferLength);
+    file.close();
+
+    recordedBytes += recorderBufferLength;
+    recorderBufferLength = 0;
+
+    if (recordedBytes >= RECORDING_MAX_BYTES) {
+        Serial.println("Recording is full; stopping");
+        isRecording = false;
+    }
+}
+
+static void WriteToRecorderBuffer(const uint8_t* data, size_t length, void* context) {
+    for (size_t i = 0; i < length; i++) {
+        if (recorderBufferLength == RECORDER_BUFFER_BYTES) {
+            FlushRecorderBuffer();
+        }
+
+        recorderBuffer[recorderBufferLength++] = data[i];
+    }
+}
+
+void StartRecording() {
+    if (!LittleFS.begin(true)) {
+        Serial.println("Failed to mount LittleFS; can't record");
+        return;
+    }
+
+    LittleFS.remove(RECORDING_PATH);
+
+    recorderBufferLength = 0;
+    recordedBytes = 0;
+    isRecording = true;
+
+    recordingWriter.Begin(WriteToRecorderBuffer, nullptr, millis());
+
+    Serial.println("Recording started");
+}
+
+void StopRecording() {
+    if (!isRecording) {
+        return;
+    }
+
+    FlushRecorderBuffer();
+    isRecording = false;
+
+    Serial.print("Recording stopped: ");
+    Serial.print(recordedBytes);
+    Serial.println(" bytes");
+}
+
+bool IsRecording() {
+    return isRecording;
+}
+
+void RecordLoop() {
+    if (isRecording) {
+        recordingWriter.WriteLoop(millis());
+    }
+}
+
+void RecordSensorReadings(uint8_t unit, const float values[RECORDING_FIELD_COUNT]) {
+    if (isRecording) {
+        recordingWriter.WriteSensorReadings(millis(), unit, values);
+    }
+}
+
+void RecordI2cError(uint8_t unit, RecordingSensor sensor) {
+    if (isRecording) {
+        recordingWriter.WriteI2cError(millis(), unit, sensor);
+    }
+}
+
+void RecordUnitState(uint8_t unit, uint8_t channel, uint8_t sensorMask) {
+    if (isRecording) {
+        recordingWriter.WriteUnitState(millis(), unit, channel, sensorMask);
+    }
+}
+
+void RecordLinkState(RecordingLink link, int8_t state) {
+    if (isRecording) {
+        recordingWriter.WriteLinkState(millis(), link, state);
+    }
+}
+
+void RecordPublish(uint8_t decision, bool isSent) {
+    if (isRecording) {
+        recordingWriter.WritePublish(millis(), decision, isSent);
+    }
+}
+
+void DumpRecordingToSerial() {
+    // Make sure the file holds everything recorded so far
+    if (isRecording) {
+        FlushRecorderBuffer();
+    }
+
+    File file = LittleFS.open(RECORDING_PATH, FILE_READ);
+    if (!file) {
+        Serial.println("No recording to dump");
+        return;
+    }
+
+    Serial.println();
+    Serial.print("# thermo_iot recording,bytes=");
+    Serial.println(file.size());
+
+    uint8_t line[32];
+    size_t lineLength;
+    while ((lineLength = file.read(line, sizeof(line))) > 0) {
+        for (size_t i = 0; i < lineLength; i++) {
+            if (line[i] < 0x10) {
+                Serial.print('0');
+            }
+            Serial.print(line[i], HEX);
+        }
+        Serial.println();
+    }
+
+    Serial.println("# end recording");
+
+    file.close();
+}
+
+bool SendRecordingToMqtt(PubSubClient& client, const char* topic) {
+    if (isRecording) {
+        FlushRecorderBuffer();
+    }
+
+    File file = LittleFS.open(RECORDING_PATH, FILE_READ);
+    if (!file) {
+        Serial.println("No recording to send");
+        return false;
+    }
+
+    if (!client.beginPublish(topic, file.size(), false)) {
+        Serial.println("Failed to beginPublish recording");
+        file.close();
+        return false;
+    }
+
+    uint8_t block[128];
+    size_t blockLength;
+    while ((blockLength = file.read(block, sizeof(block))) > 0) {
+        client.write(block, blockLength);
+    }
+    file.close();
+
+    if (!client.endPublish()) {
+        Serial.println("Failed to send recording");
+        return false;
+    }
+
+    Serial.println("Recording sent successfully.");
+    return true;
+}
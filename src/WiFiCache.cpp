@@ -0,0 +1,172 @@
+#include "WiFiCache.h"
+
+#include <string.h>
+#include <time.h>
+
+#include <Arduino.h>
+#include <lwip/dhcp.h>
+#include <lwip/etharp.h>
+#include <lwip/netif.h>
+#include <lwip/tcpip.h>
+#include <Preferences.h>
+
+#define WIFI_CACHE_NAMESPACE "wifi_cache"
+
+#define WIFI_GATEWAY_ARP_POLL_MS 100
+
+struct TcpipCall {
+    SemaphoreHandle_t done;
+    ip4_addr_t address;
+    uint32_t result;
+};
+
+// lwIP's state may only be touched from its own thread.
+// Runs the function there and waits for it to finish.
+static void RunInTcpipThread(tcpip_callback_fn function, TcpipCall& call) {
+    call.done = xSemaphoreCreateBinary();
+    if (call.done == nullptr) {
+        return;
+    }
+
+    if (tcpip_callback(function, &call) == ERR_OK) {
+        xSemaphoreTake(call.done, portMAX_DELAY);
+    }
+
+    vSemaphoreDelete(call.done);
+}
+
+static void ReadDhcpLease(void* context) {
+    TcpipCall* call = (TcpipCall*)context;
+
+    if (netif_default != nullptr && dhcp_supplied_address(netif_default)) {
+        call->result = netif_dhcp_data(netif_default)->offered_t0_lease;
+    } else {
+        call->result = 0;
+    }
+
+    xSemaphoreGive(call->done);
+}
+
+static void RequestGatewayArp(void* context) {
+    TcpipCall* call = (TcpipCall*)context;
+
+    if (netif_default != nullptr) {
+        // Forget any earlier answer, so only a fresh reply counts
+        etharp_cleanup_netif(netif_default);
+        etharp_request(netif_default, &call->address);
+    }
+
+    xSemaphoreGive(call->done);
+}
+
+static void FindGatewayArp(void* context) {
+    TcpipCall* call = (TcpipCall*)context;
+
+    struct eth_addr* ethernetAddress;
+    const ip4_addr_t* ipAddress;
+    call->result = netif_default != nullptr
+        && etharp_find_addr(netif_default, &call->address, &ethernetAddress, &ipAddress) >= 0;
+
+    xSemaphoreGive(call->done);
+}
+
+bool LoadWiFiCache(WiFiCache& cache) {
+    memset(&cache, 0, sizeof(cache));
+
+    Preferences preferences;
+    if (!preferences.begin(WIFI_CACHE_NAMESPACE, true)) {
+        return false;
+    }
+
+    cache.isValid = preferences.getBytes("bssid", cache.bssid, sizeof(cache.bssid)) == sizeof(cache.bssid);
+    cache.channel = preferences.getInt("channel", 0);
+    cache.localIp = preferences.getUInt("ip", 0);
+    cache.gateway = preferences.getUInt("gateway", 0);
+    cache.subnet = preferences.getUInt("subnet", 0);
+    cache.dns = preferences.getUInt("dns", 0);
+    cache.leaseRenewAt = preferences.getUInt("lease_renew", 0);
+
+    preferences.end();
+
+    cache.isValid = cache.isValid && cache.channel > 0 && cache.localIp != 0;
+
+    return cache.isValid;
+}
+
+bool IsWiFiCacheLeaseValid(const WiFiCache& cache) {
+    time_t now = time(nullptr);
+
+    return cache.isValid && now >= WIFI_CACHE_MIN_VALID_TIME && (uint32_t)now < cache.leaseRenewAt;
+}
+
+void SaveWiFiCache(const WiFiCache& cache) {
+    WiFiCache existing;
+    LoadWiFiCache(existing);
+
+    if (existing.isValid
+            && memcmp(existing.bssid, cache.bssid, sizeof(cache.bssid)) == 0
+            && existing.channel == cache.channel
+            && existing.localIp == cache.localIp
+            && existing.gateway == cache.gateway
+            && existing.subnet == cache.subnet
+            && existing.dns == cache.dns
+            && existing.leaseRenewAt == cache.leaseRenewAt) {
+        return;
+    }
+
+    Preferences preferences;
+    if (!preferences.begin(WIFI_CACHE_NAMESPACE, false)) {
+        Serial.println("Failed to open WiFi cache for writing");
+        return;
+    }
+
+    preferences.putBytes("bssid", cache.bssid, sizeof(cache.bssid));
+    preferences.putInt("channel", cache.channel);
+    preferences.putUInt("ip", cache.localIp);
+    preferences.putUInt("gateway", cache.gateway);
+    preferences.putUInt("subnet", cache.subnet);
+    preferences.putUInt("dns", cache.dns);
+    preferences.putUInt("lease_renew", cache.leaseRenewAt);
+
+    preferences.end();
+
+    Serial.println("WiFi cache updated");
+}
+
+void ClearWiFiCache() {
+    Preferences preferences;
+    if (!preferences.begin(WIFI_CACHE_NAMESPACE, false)) {
+        return;
+    }
+
+    preferences.clear();
+    preferences.end();
+}
+
+uint32_t GetDhcpLeaseSeconds() {
+    TcpipCall call = {};
+    RunInTcpipThread(ReadDhcpLease, call);
+
+    return call.result;
+}
+
+bool IsGatewayReachable(uint32_t gateway) {
+    if (gateway == 0) {
+        return false;
+    }
+
+    TcpipCall call = {};
+    call.address.addr = gateway;
+    RunInTcpipThread(RequestGatewayArp, call);
+
+    for (unsigned long waited = 0; waited < WIFI_GATEWAY_ARP_TIMEOUT_MS; waited += WIFI_GATEWAY_ARP_POLL_MS) {
+        delay(WIFI_GATEWAY_ARP_POLL_MS);
+
+        RunInTcpipThread(FindGatewayArp, call);
+        if (call.result) {
+            return true;
+        }
+    }
+
+    return false;
+}
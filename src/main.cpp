@@ -2,19 +2,63 @@
 #include <time.h>
 
 #include <ArduinoJson.h>
+#include <ComfortMetrics.h>
+#include <ConnectPacer.h>
 #include <esp_sntp.h>
-#include <M5UnitENV.h>
 #include <M5Unified.h>
+#include <PowerGovernor.h>
+#include <PublishScheduler.h>
 #include <PubSubClient.h>
 #include <StreamUtils.h>
+#include <Trace.h>
 #include <WiFi.h>
 
+#include "Alerts.h"
+#include "BootProfile.h"
+#include "Capture.h"
+#include "ComfortBench.h"
+#include "EnvUnits.h"
+#include "History.h"
+#include "MqttTlsClient.h"
+#include "Recorder.h"
+#include "WiFiCache.h"
 #include "secrets.h"
 
 #define NTP_SERVER1 "0.pool.ntp.org"
 #define NTP_SERVER2 "1.pool.ntp.org"
 #define NTP_SERVER3 "2.pool.ntp.org"
 
+// Height of the device above sea level in metres, for the sea level pressure
+#ifndef SECRET_STATION_ALTITUDE
+    #define SECRET_STATION_ALTITUDE 0.0f
+#endif
+
+// Start another WiFi connection attempt if one hasn't completed in this time
+#define WIFI_CONNECT_TIMEOUT_MS 10000
+
+// Shorter loop delay until the first payload is sent, so each connection step starts promptly.
+// Afterwards, or if nothing has been sent by BOOT_FAST_LOOP_MAX_MS, the loop delay is set
+// by the power profile, so a network or broker which never works doesn't keep it fast.
+#define BOOT_LOOP_DELAY_MS 100
+#define BOOT_FAST_LOOP_MAX_MS 30000
+
+// How often the buttons are checked during the loop delay; a short press lasts around 100ms
+#define BUTTON_POLL_INTERVAL_MS 20
+
+// PublishJson writes in blocks of this size.
+// Over TLS each write becomes a record with around 30 bytes of overhead.
+#ifdef SECRET_MQTT_USE_TLS
+    #define PUBLISH_WRITE_BUFFER_BYTES 512
+#else
+    #define PUBLISH_WRITE_BUFFER_BYTES 32
+#endif
+
+// The connection is only serviced once per loop, so this must be well over the longest profile loop delay
+#define MQTT_KEEPALIVE_SECONDS 60
+
+// How far back to print when the history is dumped to serial
+#define HISTORY_DUMP_SECONDS (10 * 60)
+
 #ifdef IS_M5_ATOM_LITE
     #define SDA_PORT 26
     #define SCL_PORT 32
@@ -176,85 +220,293 @@ String GetHumanReadableDatetimeString() {
     return dateString;
 }
 
-SCD4X scd4;
-SHT4X sht4;
-BMP280 bmp;
+#ifdef SECRET_MQTT_USE_TLS
+    // TLS runs over this connection to the broker
+    WiFiClient tcpClient;
+    MqttTlsClient wifiClient(tcpClient);
+#else
+    WiFiClient wifiClient;
+#endif
 
-bool isSht4xInitialised = false;
-bool isScd4xInitialised = false;
-bool isBmp280Initialised = false;
+PubSubClient mqttClient = PubSubClient(SECRET_MQTT_HOST_WITH_PROTOCOL, SECRET_MQTT_PORT, wifiClient);
 
-bool TryInitialiseSht4x() {
-    if (!sht4.begin(&Wire, SHT40_I2C_ADDR_44, SDA_PORT, SCL_PORT, 400000U)) {
-        Serial.println("Couldn't find SHT4x sensor");
-        
-        return false;
+ConnectPacer wifiClientConnectPacer;
+ConnectPacer mqttConnectPacer;
+
+bool isMqttConnected = false;
+
+HistoryStore history;
+
+bool hasRtcSyncStarted = false;
+bool hasRtcSynced = false;
+
+// Set from the WiFi event task, and acted on in loop()
+volatile bool isNtpSyncPending = false;
+
+void StartNtpSync() {
+    Serial.println("Starting NTP synchronisation");
+
+    configTzTime("UTC", NTP_SERVER1, NTP_SERVER2, NTP_SERVER3);
+    hasRtcSyncStarted = true;
+}
+
+bool isUsingWiFiCache = false;
+bool isUsingCachedLease = false;
+unsigned long wifiConnectStartedAt = 0;
+
+// The cache is saved once connected, but the lease's renewal time can only be
+// worked out once the clock is set
+bool isWiFiCachePending = false;
+WiFiCache pendingWiFiCache;
+uint32_t pendingLeaseSeconds = 0;
+unsigned long pendingLeaseStartedAt = 0;
+
+// The RTC keeps time through power off, so the clock (and the cached lease's expiry)
+// can be checked before NTP has synced
+void SetClockFromRtc() {
+    if (!M5.Rtc.isEnabled()) {
+        return;
     }
-    
-    Serial.println("Found SHT4x sensor");
 
-    // You can have 3 different precisions, higher precision takes longer
-    sht4.setPrecision(SHT4X_HIGH_PRECISION);
-    sht4.setHeater(SHT4X_NO_HEATER);
+    auto dateTime = M5.Rtc.getDateTime();
 
-    return true;
+    struct tm rtcTime = {};
+    rtcTime.tm_year = dateTime.date.year - 1900;
+    rtcTime.tm_mon = dateTime.date.month - 1;
+    rtcTime.tm_mday = dateTime.date.date;
+    rtcTime.tm_hour = dateTime.time.hours;
+    rtcTime.tm_min = dateTime.time.minutes;
+    rtcTime.tm_sec = dateTime.time.seconds;
+
+    // The RTC is kept in UTC, see UpdateAndDisplayTime
+    struct timespec rtcTimespec;
+    rtcTimespec.tv_sec = mktime(&rtcTime);
+    rtcTimespec.tv_nsec = 0;
+
+    if (rtcTimespec.tv_sec < WIFI_CACHE_MIN_VALID_TIME) {
+        return;
+    }
+
+    clock_settime(CLOCK_REALTIME, &rtcTimespec);
 }
 
-bool TryInitialiseBmp280() {
-    if (!bmp.begin(&Wire, BMP280_I2C_ADDR, SDA_PORT, SCL_PORT, 400000U)) {
-        Serial.println("Couldn't find BMP280 sensor");
-        
-        return false;
+void StartWiFi(bool useCache) {
+    TRACE_SCOPE("StartWiFi");
+
+    WiFi.mode(WIFI_STA);
+    WiFi.setHostname("Thermo_iot");
+
+    WiFiCache cache;
+    isUsingWiFiCache = useCache && LoadWiFiCache(cache);
+    isUsingCachedLease = isUsingWiFiCache && IsWiFiCacheLeaseValid(cache);
+
+    if (isUsingCachedLease) {
+        // Skip the channel scan and DHCP exchange
+        Serial.println("Connecting to WiFi with cached access point and lease");
+
+        WiFi.config(IPAddress(cache.localIp), IPAddress(cache.gateway), IPAddress(cache.subnet), IPAddress(cache.dns));
+        WiFi.begin(SECRET_WIFI_SSID, SECRET_WIFI_PASS, cache.channel, cache.bssid);
+    } else if (isUsingWiFiCache) {
+        // Skip the channel scan only
+        Serial.println("Connecting to WiFi with cached access point; the cached lease has expired or the time is unknown");
+
+        WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE, INADDR_NONE);
+        WiFi.begin(SECRET_WIFI_SSID, SECRET_WIFI_PASS, cache.channel, cache.bssid);
+    } else {
+        WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE, INADDR_NONE);
+        WiFi.begin(SECRET_WIFI_SSID, SECRET_WIFI_PASS);
     }
-    
-    Serial.println("Found BMP280 sensor");
-
-    /* Default settings from datasheet. */
-    bmp.setSampling(
-        // Operating Mode.
-        BMP280::MODE_NORMAL,
-        // Temp. oversampling.
-        BMP280::SAMPLING_X2,
-        // Pressure oversampling.
-        BMP280::SAMPLING_X16,
-        // Filtering.
-        BMP280::FILTER_X16,
-        // Standby time.
-        BMP280::STANDBY_MS_500
-    );
 
-    return true;
+    // Kept with the new cache while connected on the cached lease
+    pendingWiFiCache.leaseRenewAt = isUsingCachedLease ? cache.leaseRenewAt : 0;
+
+    wifiConnectStartedAt = millis();
 }
 
-bool TryInitialiseScd4x() {
-    if (!scd4.begin(&Wire, SCD4X_I2C_ADDR, SDA_PORT, SCL_PORT, 400000U)) {
-        Serial.println("Couldn't find SCD4X");
-        return false;
+// Called from the WiFi event task
+void OnWiFiEvent(WiFiEvent_t event) {
+    TRACE_SCOPE("OnWiFiEvent");
+
+    if (event == ARDUINO_EVENT_WIFI_STA_CONNECTED) {
+        MarkBootPhase(BOOT_PHASE_WIFI_CONNECTED);
+    } else if (event == ARDUINO_EVENT_WIFI_STA_GOT_IP) {
+        MarkBootPhase(BOOT_PHASE_WIFI_GOT_IP);
+
+        // Start NTP on the next loop rather than waiting for the status check
+        isNtpSyncPending = true;
     }
+}
 
-    // stop potentially previously started measurement
-    if (scd4.stopPeriodicMeasurement()) {
-        Serial.print("Error trying to execute stopPeriodicMeasurement()");
-        Serial.println();
+void StartPendingNtpSync() {
+    if (!isNtpSyncPending) {
+        return;
     }
 
-    // Start Measurement
-    if (scd4.startPeriodicMeasurement()) {
-        Serial.print("Error trying to execute startPeriodicMeasurement()");
-        Serial.println();
+    isNtpSyncPending = false;
+
+    if (!hasRtcSynced) {
+        StartNtpSync();
+    }
+}
+
+// Saves the cache once the lease's renewal time is known
+void SavePendingWiFiCache() {
+    time_t now = time(nullptr);
+    if (!isWiFiCachePending || now < WIFI_CACHE_MIN_VALID_TIME) {
+        return;
     }
 
-    Serial.println("Waiting for first measurement... (5 sec)");
+    isWiFiCachePending = false;
 
-    return true;
+    if (pendingLeaseSeconds != 0) {
+        uint32_t leaseStartedAt = (uint32_t)now - (millis() - pendingLeaseStartedAt) / 1000;
+        pendingWiFiCache.leaseRenewAt = leaseStartedAt + pendingLeaseSeconds / 2;
+    }
+
+    SaveWiFiCache(pendingWiFiCache);
 }
 
-WiFiClient wifiClient;
-PubSubClient mqttClient = PubSubClient(SECRET_MQTT_HOST_WITH_PROTOCOL, SECRET_MQTT_PORT, wifiClient);
+PublishScheduler publishScheduler;
 
-bool isMqttConnected = false;
+PowerGovernor powerGovernor;
+BatteryStatus batteryStatus;
+
+// Sent to <topic>/power once connected
+bool isPowerProfilePending = true;
+
+bool isDisplayAsleep = false;
+unsigned long lastButtonPressAt = 0;
+
+BatteryStatus ReadBatteryStatus() {
+    BatteryStatus battery;
+
+    // The ATOM Lite has no battery or power management chip to read
+    battery.level = M5.Power.getType() == m5::Power_Class::pmic_unknown ? -1 : M5.Power.getBatteryLevel();
+
+    auto chargeState = M5.Power.isCharging();
+    battery.isChargeKnown = chargeState != M5.Power.charge_unknown;
+    battery.isCharging = chargeState == M5.Power.is_charging;
+
+    return battery;
+}
+
+wifi_ps_type_t GetWiFiPowerSaveType(WifiPowerSave powerSave) {
+    if (powerSave == WIFI_POWER_SAVE_NONE) {
+        return WIFI_PS_NONE;
+    }
+
+    if (powerSave == WIFI_POWER_SAVE_MAX) {
+        return WIFI_PS_MAX_MODEM;
+    }
+
+    return WIFI_PS_MIN_MODEM;
+}
+
+void ApplyPowerProfile() {
+    const PowerProfileSettings& settings = powerGovernor.GetSettings();
+
+    Serial.print("Power profile: ");
+    Serial.println(settings.name);
+
+    publishScheduler.SetIntervalLoops(settings.publishIntervalLoops);
+    SetEnvUnitsPrecision(settings.sensorPrecision);
+    WiFi.setSleep(GetWiFiPowerSaveType(settings.wifiPowerSave));
+
+    if (!isDisplayAsleep) {
+        M5.Display.setBrightness(settings.displayBrightness);
+    }
+}
+
+void UpdatePowerProfile() {
+    TRACE_SCOPE("UpdatePowerProfile");
+
+    batteryStatus = ReadBatteryStatus();
+
+    if (powerGovernor.Update(millis(), batteryStatus)) {
+        ApplyPowerProfile();
+        isPowerProfilePending = true;
+    }
+}
+
+// Turns the display off after the profile's timeout, and back on at a button press.
+// Returns true if a button press woke the display, so it shouldn't also act on the press.
+bool UpdateDisplaySleep() {
+    bool wasPressed = M5.BtnA.wasPressed() || M5.BtnB.wasPressed();
+    if (wasPressed) {
+        lastButtonPressAt = millis();
+    }
+
+    const PowerProfileSettings& settings = powerGovernor.GetSettings();
+    bool shouldSleep = settings.displayTimeoutMillis != 0
+        && millis() - lastButtonPressAt >= settings.displayTimeoutMillis;
+
+    if (shouldSleep && !isDisplayAsleep) {
+        M5.Display.sleep();
+        isDisplayAsleep = true;
+    } else if (!shouldSleep && isDisplayAsleep) {
+        M5.Display.wakeup();
+        M5.Display.setBrightness(settings.displayBrightness);
+        isDisplayAsleep = false;
+
+        return wasPressed;
+    }
+
+    return false;
+}
+
+void WritePowerToJson(JsonObject power) {
+    power["profile"] = powerGovernor.GetSettings().name;
+
+    power["battery"]["level"]["value"] = batteryStatus.level;
+    power["battery"]["level"]["unit"] = "%";
+
+    if (batteryStatus.isChargeKnown) {
+        power["battery"]["charging"] = batteryStatus.isCharging;
+    }
+
+    if (powerGovernor.HasDischargeRate()) {
+        power["battery"]["dischargeRate"]["value"] = powerGovernor.GetDischargeRate();
+        power["battery"]["dischargeRate"]["unit"] = "%/h";
+    }
+}
+
+bool isTraceRequested = false;
+bool isRecordingRequested = false;
+bool isTlsStatsRequested = false;
+
+// Commands arrive on <topic>/command, alert rules on <topic>/rules
+void OnMqttMessage(char* topic, byte* payload, unsigned int length) {
+    if (strcmp(topic, SECRET_MQTT_TOPIC "/rules") == 0) {
+        SetAlertRules((const char*)payload, length);
+        return;
+    }
+
+    String command;
+    for (unsigned int i = 0; i < length; i++) {
+        command += (char)payload[i];
+    }
+    command.trim();
+
+    Serial.print("MQTT command: ");
+    Serial.println(command);
+
+    // Replies are sent from loop(), as the client's buffer holds this message
+    if (command == "trace") {
+        isTraceRequested = true;
+    } else if (command == "record start") {
+        StartRecording();
+    } else if (command == "record stop") {
+        StopRecording();
+    } else if (command == "recording") {
+        isRecordingRequested = true;
+    } else if (command == "tls") {
+        isTlsStatsRequested = true;
+    }
+}
 
 void setup() {
+    TRACE_SCOPE("setup");
+
     auto cfg = M5.config();
 
     M5.begin(cfg);
@@ -264,37 +516,162 @@ void setup() {
     Serial.begin(115200);
     Serial.flush();
 
+    MarkBootPhase(BOOT_PHASE_SETUP_START);
+
+    SetClockFromRtc();
+
+    // Associate with the access point while the sensors are initialised
+    WiFi.onEvent(OnWiFiEvent);
+    StartWiFi(true);
+    MarkBootPhase(BOOT_PHASE_WIFI_STARTED);
+
     Serial.println("Initialising...");
     
-    Wire.begin(SDA_PORT, SCL_PORT, 400000U);
+    BeginEnvUnits(SDA_PORT, SCL_PORT);
 
-    isSht4xInitialised = TryInitialiseSht4x();
+    MarkBootPhase(BOOT_PHASE_SENSORS_INITIALISED);
 
-    isBmp280Initialised = TryInitialiseBmp280();
+    history.Begin();
 
-    isScd4xInitialised = TryInitialiseScd4x();
+    BeginAlerts();
 
     M5.Display.setRotation(1);
     M5.Display.clear();
     M5.Display.setCursor(0,0);
+
+    mqttClient.setCallback(OnMqttMessage);
+    // Room for the alert rules to arrive in one message
+    mqttClient.setBufferSize(ALERT_RULES_MAX_BYTES + 128);
+    mqttClient.setKeepAlive(MQTT_KEEPALIVE_SECONDS);
+
+#ifdef SECRET_MQTT_USE_TLS
+    if (!wifiClient.Begin(SECRET_MQTT_CA_CERT)) {
+        Serial.println("Failed to set up TLS; MQTT won't connect");
+    }
+#endif
+
+    // Start in the profile for the current battery rather than stepping down on the first loop
+    batteryStatus = ReadBatteryStatus();
+    powerGovernor.Update(millis(), batteryStatus);
+    ApplyPowerProfile();
+
+#ifdef COMFORT_BENCH
+    RunComfortBench();
+#endif
+
+    MarkBootPhase(BOOT_PHASE_SETUP_END);
 }
 
-bool hasRtcSyncStarted = false;
-bool hasRtcSynced = false;
+bool PublishJson(const char* topic, JsonDocument& doc) {
+    TRACE_SCOPE("PublishJson");
 
-void SendSensorPayloadToMqtt() {
-    Serial.println();
+    if (!mqttClient.beginPublish(topic, measureJson(doc), false)) {
+        auto writeError = mqttClient.getWriteError();
+        Serial.print("Failed to beginPublish to ");
+        Serial.print(topic);
+        Serial.print(" with write error: ");
+        Serial.println(writeError);
+    }
 
-    if (!mqttClient.connected()) {
-        Serial.println("Refusing to send sensor data as MQTT client is disconnected");
+    BufferingPrint bufferedClient(mqttClient, PUBLISH_WRITE_BUFFER_BYTES);
+    serializeJson(doc, bufferedClient);
+    bufferedClient.flush();
+
+    if (!mqttClient.endPublish()) {
+        auto writeError = mqttClient.getWriteError();
+        Serial.print("Failed to publish to ");
+        Serial.print(topic);
+        Serial.print(" with write error: ");
+        Serial.println(writeError);
+        return false;
+    }
+
+    return true;
+}
+
+void SendBootProfileToMqtt() {
+    JsonDocument doc;
+    doc["device"]["name"] = SECRET_MQTT_DEVICE_NAME;
+    doc["fastReconnect"] = isUsingWiFiCache;
+
+    WriteBootProfileToJson(doc);
+
+    if (PublishJson(SECRET_MQTT_TOPIC "/boot", doc)) {
+        Serial.println("Boot profile sent successfully.");
+    }
+}
+
+#ifdef SECRET_MQTT_USE_TLS
+void WriteTlsHandshakeStatsToJson(JsonObject json, const TlsHandshakeStats& stats) {
+    json["count"] = stats.count;
+
+    if (stats.count == 0) {
         return;
     }
 
-    if (!hasRtcSynced) {
+    json["lastTime"]["value"] = stats.lastMicros;
+    json["lastTime"]["unit"] = "us";
+
+    json["meanTime"]["value"] = (uint32_t)(stats.totalMicros / stats.count);
+    json["meanTime"]["unit"] = "us";
+
+    json["heap"]["value"] = stats.lastHeapBytes;
+    json["heap"]["unit"] = "B";
+
+    json["minFreeHeap"]["value"] = stats.lastMinFreeHeap;
+    json["minFreeHeap"]["unit"] = "B";
+}
+#endif
+
+void SendTlsStatsToMqtt() {
+#ifdef SECRET_MQTT_USE_TLS
+    const TlsStats& stats = wifiClient.GetStats();
+
+    JsonDocument doc;
+    doc["device"]["name"] = SECRET_MQTT_DEVICE_NAME;
+
+    WriteTlsHandshakeStatsToJson(doc["full"].to<JsonObject>(), stats.full);
+    WriteTlsHandshakeStatsToJson(doc["resumed"].to<JsonObject>(), stats.resumed);
+
+    doc["failures"] = stats.failures;
+    doc["lastError"] = stats.lastError;
+
+    if (PublishJson(SECRET_MQTT_TOPIC "/tls", doc)) {
+        Serial.println("TLS stats sent successfully.");
+    }
+#else
+    Serial.println("Not using TLS; no stats to send");
+#endif
+}
+
+void SendPowerProfileToMqtt() {
+    JsonDocument doc;
+    doc["device"]["name"] = SECRET_MQTT_DEVICE_NAME;
+
+    WritePowerToJson(doc["power"].to<JsonObject>());
+
+    if (PublishJson(SECRET_MQTT_TOPIC "/power", doc)) {
+        Serial.println("Power profile sent successfully.");
+        isPowerProfilePending = false;
+    }
+}
+
+void PrintPublishRefusal(PublishDecision decision) {
+    Serial.println();
+
+    if (decision == PUBLISH_REFUSED_DISCONNECTED) {
+        Serial.println("Refusing to send sensor data as MQTT client is disconnected");
+    } else if (decision == PUBLISH_REFUSED_NOT_SYNCED) {
         Serial.println("Refusing to send sensor data as Clock has not synced");
-        return;
+    } else if (decision == PUBLISH_REFUSED_NO_DATA) {
+        Serial.println("No sensor data to write. Skipping.");
     }
+}
+
+bool SendSensorPayloadToMqtt() {
+    TRACE_SCOPE("SendSensorPayloadToMqtt");
 
+    Serial.println();
     Serial.println("Attempting to send sensor data");
 
     auto datetimeString = GetDatetimeString();
@@ -306,65 +683,94 @@ void SendSensorPayloadToMqtt() {
 
     doc["device"]["name"] = SECRET_MQTT_DEVICE_NAME;
 
-    if (isSht4xInitialised) {
-        doc["SHT4X"]["temperature"]["value"] = sht4.cTemp;
-        doc["SHT4X"]["temperature"]["unit"] = "C";
-    
-        doc["SHT4X"]["humidity"]["value"] = sht4.humidity;
-        doc["SHT4X"]["humidity"]["unit"] = "%";
-    }
-    
-    if (isBmp280Initialised) {
-        doc["BMP280"]["temperature"]["value"] = bmp.cTemp;
-        doc["BMP280"]["temperature"]["unit"] = "C";
-        
-        doc["BMP280"]["pressure"]["value"] = bmp.pressure;
-        doc["BMP280"]["pressure"]["unit"] = "Pa";
-    }
-    
-    if (isScd4xInitialised) {
-        doc["SCD4X"]["temperature"]["value"] = scd4.getTemperature();
-        doc["SCD4X"]["temperature"]["unit"] = "C";
-        
-        doc["SCD4X"]["humidity"]["value"] = scd4.getHumidity();
-        doc["SCD4X"]["humidity"]["unit"] = "%";
-        
-        doc["SCD4X"]["co2"]["value"] = scd4.getCO2();
-        doc["SCD4X"]["co2"]["unit"] = "ppm";
+    doc["readTime"]["value"] = GetEnvUnitsReadMicros();
+    doc["readTime"]["unit"] = "us";
+
+    WritePowerToJson(doc["power"].to<JsonObject>());
+
+    JsonArray units = doc["units"].to<JsonArray>();
+
+    for (int i = 0; i < GetEnvUnitCount(); i++) {
+        EnvUnit& unit = GetEnvUnit(i);
+
+        if (!HasAnySensorInitialised(unit) || unit.isSelectFailed) {
+            continue;
+        }
+
+        JsonObject unitJson = units.add<JsonObject>();
+        unitJson["channel"] = unit.label;
+
+        unitJson["readTime"]["value"] = unit.readMicros;
+        unitJson["readTime"]["unit"] = "us";
+
+        if (unit.isSht4xInitialised) {
+            unitJson["SHT4X"]["temperature"]["value"] = unit.sht4.cTemp;
+            unitJson["SHT4X"]["temperature"]["unit"] = "C";
+
+            unitJson["SHT4X"]["humidity"]["value"] = unit.sht4.humidity;
+            unitJson["SHT4X"]["humidity"]["unit"] = "%";
+        }
+
+        if (unit.isBmp280Initialised) {
+            unitJson["BMP280"]["temperature"]["value"] = unit.bmp.cTemp;
+            unitJson["BMP280"]["temperature"]["unit"] = "C";
+
+            unitJson["BMP280"]["pressure"]["value"] = unit.bmp.pressure;
+            unitJson["BMP280"]["pressure"]["unit"] = "Pa";
+        }
+
+        if (unit.isScd4xInitialised) {
+            unitJson["SCD4X"]["temperature"]["value"] = unit.scd4.getTemperature();
+            unitJson["SCD4X"]["temperature"]["unit"] = "C";
+
+            unitJson["SCD4X"]["humidity"]["value"] = unit.scd4.getHumidity();
+            unitJson["SCD4X"]["humidity"]["unit"] = "%";
+
+            unitJson["SCD4X"]["co2"]["value"] = unit.scd4.getCO2();
+            unitJson["SCD4X"]["co2"]["unit"] = "ppm";
+        }
+
+        if (unit.isSht4xInitialised) {
+            unitJson["derived"]["dewPoint"]["value"] = unit.comfortMetrics.dewPoint;
+            unitJson["derived"]["dewPoint"]["unit"] = "C";
+
+            unitJson["derived"]["absoluteHumidity"]["value"] = unit.comfortMetrics.absoluteHumidity;
+            unitJson["derived"]["absoluteHumidity"]["unit"] = "g/m3";
+
+            unitJson["derived"]["heatIndex"]["value"] = unit.comfortMetrics.heatIndex;
+            unitJson["derived"]["heatIndex"]["unit"] = "C";
+        }
+
+        if (unit.isBmp280Initialised) {
+            unitJson["derived"]["seaLevelPressure"]["value"] = unit.comfortMetrics.seaLevelPressure;
+            unitJson["derived"]["seaLevelPressure"]["unit"] = "Pa";
+        }
     }
 
-    if (!isSht4xInitialised && ! isBmp280Initialised && !isScd4xInitialised) {
+    if (units.size() == 0) {
         Serial.println("No sensor data to write. Skipping.");
-        return;
+        return false;
     }
 
-    if (!mqttClient.beginPublish(SECRET_MQTT_TOPIC, measureJson(doc), false)) {
-        auto writeError = mqttClient.getWriteError();
-        Serial.print("Failed to beginPublish sensor data with write error: ");
-        Serial.println(writeError);
+    if (!PublishJson(SECRET_MQTT_TOPIC, doc)) {
+        return false;
     }
 
-    BufferingPrint bufferedClient(mqttClient, 32);
-    serializeJson(doc, bufferedClient);
-    bufferedClient.flush();
-    
-    if (mqttClient.endPublish()) {
-        Serial.println("Sensor data sent successfully.");
-    } else {
-        auto writeError = mqttClient.getWriteError();
-        Serial.print("Failed to send sensor data with write error: ");
-        Serial.println(writeError);
+    Serial.println("Sensor data sent successfully.");
+
+    if (!HasReachedBootPhase(BOOT_PHASE_FIRST_PUBLISH)) {
+        MarkBootPhase(BOOT_PHASE_FIRST_PUBLISH);
+        SendBootProfileToMqtt();
     }
+
+    return true;
 }
 
 int batteryDisplayLength = 7;
 void DisplayBattery() {
-    int batteryLevel = M5.Power.getBatteryLevel();
-
-    bool isCharging = false;
-    if (!M5.Power.charge_unknown) {
-        isCharging = M5.Power.isCharging();
-    }
+    // Read each loop by UpdatePowerProfile
+    int batteryLevel = batteryStatus.level;
+    bool isCharging = batteryStatus.isChargeKnown && batteryStatus.isCharging;
 
     if (!isCharging) {
         M5.Display.print("   ");
@@ -394,6 +800,8 @@ bool isWifiConnected = false;
 
 const int wifiDisplayLength = 22;
 void UpdateAndDisplayWiFiStatus() {
+    TRACE_SCOPE("UpdateAndDisplayWiFiStatus");
+
     auto status = WiFi.status();
 
     if (status == WL_CONNECTED) {
@@ -408,6 +816,33 @@ void UpdateAndDisplayWiFiStatus() {
             Serial.println(rssi);
 
             isWifiConnected = true;
+
+            WiFiCache& cache = pendingWiFiCache;
+            cache.isValid = true;
+            memcpy(cache.bssid, WiFi.BSSID(), sizeof(cache.bssid));
+            cache.channel = WiFi.channel();
+            cache.localIp = (uint32_t)localIp;
+            cache.gateway = (uint32_t)WiFi.gatewayIP();
+            cache.subnet = (uint32_t)WiFi.subnetMask();
+            cache.dns = (uint32_t)WiFi.dnsIP();
+
+            // 0 on the cached lease, which keeps its renewal time
+            pendingLeaseSeconds = GetDhcpLeaseSeconds();
+            pendingLeaseStartedAt = millis();
+            isWiFiCachePending = true;
+        }
+
+        SavePendingWiFiCache();
+
+        // A static address isn't renewed, so hand back to DHCP when the lease would be
+        if (isUsingCachedLease && !IsWiFiCacheLeaseValid(pendingWiFiCache)
+                && time(nullptr) >= WIFI_CACHE_MIN_VALID_TIME) {
+            Serial.println("Cached lease is due for renewal; reconnecting with DHCP");
+
+            isWifiConnected = false;
+            WiFi.disconnect();
+            StartWiFi(true);
+            return;
         }
 
         // Print 22 characters to fully clear the old IP and RSSI
@@ -453,17 +888,26 @@ void UpdateAndDisplayWiFiStatus() {
         M5.Display.print("Disconnected    ");
     }
 
+    // Give the current attempt a chance to finish before starting another
+    bool hasFailed = status == WL_CONNECT_FAILED || status == WL_NO_SSID_AVAIL || status == WL_CONNECTION_LOST;
+    if (!hasFailed && millis() - wifiConnectStartedAt < WIFI_CONNECT_TIMEOUT_MS) {
+        return;
+    }
+
+    if (isUsingWiFiCache) {
+        Serial.println("Cached WiFi details failed; falling back to a full scan");
+        ClearWiFiCache();
+    }
+
     Serial.println("Attempting to connect to WiFi");
 
-    WiFi.mode(WIFI_STA);
-    WiFi.setHostname("Thermo_iot");
-    
-    WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE, INADDR_NONE);
-    WiFi.begin(SECRET_WIFI_SSID, SECRET_WIFI_PASS);
+    StartWiFi(false);
 }
 
 int timestampDisplayCharacters = 20;
 void UpdateAndDisplayTime() {
+    TRACE_SCOPE("UpdateAndDisplayTime");
+
     if (hasRtcSynced) {
         auto timestamp = GetHumanReadableDatetimeString();
         M5.Display.print(timestamp);
@@ -487,7 +931,7 @@ void UpdateAndDisplayTime() {
     Serial.println(status);
 
     // Is the sync ongoing?
-    if (hasRtcSyncStarted || status == SNTP_SYNC_STATUS_IN_PROGRESS) {
+    if ((hasRtcSyncStarted && status != SNTP_SYNC_STATUS_COMPLETED) || status == SNTP_SYNC_STATUS_IN_PROGRESS) {
         auto timestamp = GetHumanReadableDatetimeString();
         M5.Display.print(timestamp);
         M5.Display.print('*');
@@ -497,6 +941,7 @@ void UpdateAndDisplayTime() {
     // Is this the first check after the sync has completed?
     if (status == SNTP_SYNC_STATUS_COMPLETED) {
         hasRtcSynced = true;
+        MarkBootPhase(BOOT_PHASE_NTP_SYNCED);
 
         // Update the clock
         time_t t = time(nullptr) + 1;
@@ -532,9 +977,7 @@ void UpdateAndDisplayTime() {
     }
     
     // Start the sync
-    Serial.println("Starting NTP synchronisation");
-    
-    configTzTime("UTC", NTP_SERVER1, NTP_SERVER2, NTP_SERVER3);
+    StartNtpSync();
 
     auto timestamp = GetHumanReadableDatetimeString();
     M5.Display.print(timestamp);
@@ -542,6 +985,8 @@ void UpdateAndDisplayTime() {
 }
 
 void DisplayStatusBar() {
+    TRACE_SCOPE("DisplayStatusBar");
+
     int displayWidthPixels = M5.Display.width();
     int characterWidthPixels = M5.Display.fontWidth();
     int centralSpace = (displayWidthPixels / characterWidthPixels) - (timestampDisplayCharacters + batteryDisplayLength);
@@ -565,6 +1010,8 @@ bool isWifiClientConnected = false;
 
 const int wifiClientDisplayLength = 16;
 void UpdateAndDisplayWiFiClientStatus() {
+    TRACE_SCOPE("UpdateAndDisplayWiFiClientStatus");
+
     M5.Display.print("WiFi: ");
 
     isWifiClientConnected = wifiClient.connected();
@@ -580,22 +1027,55 @@ void UpdateAndDisplayWiFiClientStatus() {
         return;
     }
 
+#ifdef SECRET_MQTT_USE_TLS
+    // The broker's certificate dates can't be checked until the RTC or NTP has set the clock
+    if (!MqttTlsClient::IsClockValid()) {
+        M5.Display.print("No time...");
+        Serial.println("Refusing to connect to WiFi client; clock not set for TLS.");
+        return;
+    }
+#endif
+
+    if (!wifiClientConnectPacer.IsDue(millis())) {
+        M5.Display.print("Retrying  ");
+        return;
+    }
+
     Serial.print("Attempting to connect to WiFi client (");
     Serial.print(SECRET_MQTT_HOST);
     Serial.print(":");
     Serial.print(SECRET_MQTT_PORT);
     Serial.println(")");
 
-    if (wifiClient.connect(SECRET_MQTT_HOST, SECRET_MQTT_PORT)) {
+    bool hasConnected;
+    {
+        TRACE_SCOPE("wifiClient.connect");
+        hasConnected = wifiClient.connect(SECRET_MQTT_HOST, SECRET_MQTT_PORT);
+    }
+    wifiClientConnectPacer.OnAttempt(millis(), hasConnected);
+
+    if (hasConnected) {
         Serial.println("Connected to WiFi client");
         M5.Display.print("Connected!");
         
         isWifiClientConnected = true;
+        MarkBootPhase(BOOT_PHASE_WIFI_CLIENT_CONNECTED);
     } else {
         Serial.println("Failed to connect to WiFi client");
         M5.Display.print("Failed    ");
 
         isWifiClientConnected = false;
+
+        // The cached lease may have been given to another device, in which case the
+        // gateway won't answer. Otherwise the broker is down or refused the connection,
+        // and the cache is kept.
+        if (isUsingCachedLease && !IsGatewayReachable((uint32_t)WiFi.gatewayIP())) {
+            Serial.println("Gateway unreachable; dropping cached WiFi details and reconnecting with DHCP");
+            ClearWiFiCache();
+            isWifiConnected = false;
+            WiFi.disconnect();
+            StartWiFi(false);
+        }
     }
 }
 
@@ -603,6 +1083,8 @@ bool isMqttClientConnected = false;
 
 const int mqttClientDisplayLength = 20;
 void UpdateAndDisplayMqttClientStatus() {
+    TRACE_SCOPE("UpdateAndDisplayMqttClientStatus");
+
     M5.Display.print("MQTT: ");
     
     auto state = mqttClient.state();
@@ -610,6 +1092,7 @@ void UpdateAndDisplayMqttClientStatus() {
     if (state == MQTT_CONNECTED) {
         isMqttClientConnected = true;
         M5.Display.print("Connected!  ");
+        MarkBootPhase(BOOT_PHASE_MQTT_CONNECTED);
         return;
     }
     
@@ -619,12 +1102,6 @@ void UpdateAndDisplayMqttClientStatus() {
         return;
     }
     
-    if (!hasRtcSynced) {
-        M5.Display.print("Waiting...  ");
-        Serial.println("Refusing to connect to MQTT client; RTC not synced.");
-        return;
-    }
-
     if (state == MQTT_CONNECTION_TIMEOUT) {
         Serial.println("MQTT state: MQTT_CONNECTION_TIMEOUT");
         M5.Display.print("Timeout     ");
@@ -662,13 +1139,27 @@ void UpdateAndDisplayMqttClientStatus() {
         M5.Display.print("Unauthorized");
     }
 
+    if (!mqttConnectPacer.IsDue(millis())) {
+        return;
+    }
+
     Serial.println("Attempting to connect to MQTT");
     Serial.print("Client id: ");
     Serial.println(SECRET_MQTT_CLIENT_ID);
     Serial.print("Username: ");
     Serial.println(SECRET_MQTT_USER);
 
-    mqttClient.connect(SECRET_MQTT_CLIENT_ID, SECRET_MQTT_USER, SECRET_MQTT_PASS);
+    bool hasConnected;
+    {
+        TRACE_SCOPE("mqttClient.connect");
+        hasConnected = mqttClient.connect(SECRET_MQTT_CLIENT_ID, SECRET_MQTT_USER, SECRET_MQTT_PASS);
+    }
+    mqttConnectPacer.OnAttempt(millis(), hasConnected);
+
+    if (hasConnected) {
+        mqttClient.subscribe(SECRET_MQTT_TOPIC "/command");
+        mqttClient.subscribe(SECRET_MQTT_TOPIC "/rules");
+    }
 }
 
 void DisplayLowerStatusBar() {
@@ -688,58 +1179,107 @@ void DisplayLowerStatusBar() {
 }
 
 void WriteToSerial() {
+    TRACE_SCOPE("WriteToSerial");
+
     Serial.println();
     Serial.println("----------------");
 
-    if (isSht4xInitialised) {
-        Serial.print("Temp (SHT4X): ");
-        Serial.print(sht4.cTemp);
-        Serial.println("C");
-        
-        Serial.print("Humidity (SHT4X): ");
-        Serial.print(sht4.humidity);
-        Serial.println("% RH");
-    }
+    for (int i = 0; i < GetEnvUnitCount(); i++) {
+        EnvUnit& unit = GetEnvUnit(i);
 
-    if (isBmp280Initialised) {
-        Serial.print("Temp (BMP280): ");
-        Serial.print(bmp.cTemp);
-        Serial.println("C");
+        if (!HasAnySensorInitialised(unit)) {
+            continue;
+        }
 
-        Serial.print("Pressure: ");
-        Serial.print(bmp.pressure);
-        Serial.println("Pa");
+        Serial.print("Unit ");
+        Serial.print(unit.label);
 
-        Serial.print("Approx altitude: ");
-        Serial.print(bmp.altitude);
-        Serial.println("m");
-    }
+        if (unit.isSelectFailed) {
+            Serial.println(": couldn't switch the hub to it");
+            continue;
+        }
 
-    if (isScd4xInitialised) {
-        Serial.print("Temp (SCD4X): ");
-        Serial.print(scd4.getTemperature());
-        Serial.println("C");
-        
-        Serial.print("C02: ");
-        Serial.print(scd4.getCO2());
-        Serial.println("ppm");
-        
-        Serial.print("Humidity: ");
-        Serial.print(scd4.getHumidity());
-        Serial.println("% RH");
+        Serial.print(" (read in ");
+        Serial.print(unit.readMicros);
+        Serial.println("us)");
+
+        if (unit.isSht4xInitialised) {
+            Serial.print("Temp (SHT4X): ");
+            Serial.print(unit.sht4.cTemp);
+            Serial.println("C");
+
+            Serial.print("Humidity (SHT4X): ");
+            Serial.print(unit.sht4.humidity);
+            Serial.println("% RH");
+
+            Serial.print("Dew point: ");
+            Serial.print(unit.comfortMetrics.dewPoint);
+            Serial.println("C");
+        }
+
+        if (unit.isBmp280Initialised) {
+            Serial.print("Temp (BMP280): ");
+            Serial.print(unit.bmp.cTemp);
+            Serial.println("C");
+
+            Serial.print("Pressure: ");
+            Serial.print(unit.bmp.pressure);
+            Serial.println("Pa");
+
+            Serial.print("Approx altitude: ");
+            Serial.print(unit.bmp.altitude);
+            Serial.println("m");
+        }
+
+        if (unit.isScd4xInitialised) {
+            Serial.print("Temp (SCD4X): ");
+            Serial.print(unit.scd4.getTemperature());
+            Serial.println("C");
+
+            Serial.print("C02: ");
+            Serial.print(unit.scd4.getCO2());
+            Serial.println("ppm");
+
+            Serial.print("Humidity: ");
+            Serial.print(unit.scd4.getHumidity());
+            Serial.println("% RH");
+        }
     }
 
+    Serial.print("All units read in ");
+    Serial.print(GetEnvUnitsReadMicros());
+    Serial.println("us");
+
     Serial.println("----------------");
     Serial.println();
 }
 
 void WriteToDisplay() {
+    TRACE_SCOPE("WriteToDisplay");
+
     M5.Display.setCursor(0, 0);
 
+    // The status bars also keep the clock, WiFi, broker and MQTT connections going, so
+    // they still run while the display is asleep, clipped to nothing so nothing is drawn
+    if (isDisplayAsleep) {
+        M5.Display.setClipRect(0, 0, 0, 0);
+        M5.Display.setTextSize(1);
+        DisplayStatusBar();
+        DisplayLowerStatusBar();
+        M5.Display.clearClipRect();
+        return;
+    }
+
     M5.Display.setTextSize(1);
     DisplayStatusBar();
     M5.Display.println();
 
+    // Only the first unit fits on the display
+    EnvUnit* unit = GetPrimaryEnvUnit();
+    bool isSht4xInitialised = unit != nullptr && unit->isSht4xInitialised;
+    bool isBmp280Initialised = unit != nullptr && unit->isBmp280Initialised;
+    bool isScd4xInitialised = unit != nullptr && unit->isScd4xInitialised;
+
     // ========
     // Temperature
     // ========
@@ -747,15 +1287,15 @@ void WriteToDisplay() {
     float totalTemperature = 0.0;
     int temperatureDataPoints = 0;
     if (isSht4xInitialised) {
-        totalTemperature += sht4.cTemp;
+        totalTemperature += unit->sht4.cTemp;
         temperatureDataPoints++;
     }
     if (isBmp280Initialised) {
-        totalTemperature += bmp.cTemp;
+        totalTemperature += unit->bmp.cTemp;
         temperatureDataPoints++;
     }
     if (isScd4xInitialised) {
-        totalTemperature += scd4.getTemperature();
+        totalTemperature += unit->scd4.getTemperature();
         temperatureDataPoints++;
     }
 
@@ -778,7 +1318,7 @@ void WriteToDisplay() {
 
     M5.Display.setTextSize(3);
     if (isSht4xInitialised) {
-        M5.Display.print(sht4.humidity);
+        M5.Display.print(unit->sht4.humidity);
         M5.Display.println("% RH ");
     } else {
         M5.Display.println("N/A        ");
@@ -794,7 +1334,7 @@ void WriteToDisplay() {
     M5.Display.setTextSize(2);
 
     if (isBmp280Initialised) {
-        auto pressure = int(bmp.pressure);
+        auto pressure = int(unit->bmp.pressure);
         M5.Display.print(pressure);
         M5.Display.print("Pa ");
         if (pressure < 10) M5.Display.print(" ");
@@ -808,7 +1348,7 @@ void WriteToDisplay() {
     }
 
     if (isScd4xInitialised) {
-        M5.Display.print(scd4.getCO2());
+        M5.Display.print(unit->scd4.getCO2());
         M5.Display.print("ppm");
     } else {
         M5.Display.print("N/A ppm      ");
@@ -827,51 +1367,421 @@ void WriteToDisplay() {
     // M5.Display.print(bmp.altitude);
 }
 
+void UpdateComfortMetrics() {
+    TRACE_SCOPE("UpdateComfortMetrics");
+
+    for (int i = 0; i < GetEnvUnitCount(); i++) {
+        EnvUnit& unit = GetEnvUnit(i);
+
+        if (unit.isSht4xInitialised) {
+            unit.comfortMetrics.dewPoint = CalculateDewPoint(unit.sht4.cTemp, unit.sht4.humidity);
+            unit.comfortMetrics.absoluteHumidity = CalculateAbsoluteHumidity(unit.sht4.cTemp, unit.sht4.humidity);
+            unit.comfortMetrics.heatIndex = CalculateHeatIndex(unit.sht4.cTemp, unit.sht4.humidity);
+        }
+
+        if (unit.isBmp280Initialised) {
+            unit.comfortMetrics.seaLevelPressure = CalculateSeaLevelPressure(unit.bmp.pressure, unit.bmp.cTemp, SECRET_STATION_ALTITUDE);
+        }
+    }
+}
+
+// In HistoryField order, NAN for sensors which aren't initialised
+void GetSensorValues(EnvUnit& unit, float values[HISTORY_FIELD_COUNT]) {
+    for (int i = 0; i < HISTORY_FIELD_COUNT; i++) {
+        values[i] = NAN;
+    }
+
+    // The readings weren't updated
+    if (unit.isSelectFailed) {
+        return;
+    }
+
+    if (unit.isSht4xInitialised) {
+        values[HISTORY_SHT4X_TEMPERATURE] = unit.sht4.cTemp;
+        values[HISTORY_SHT4X_HUMIDITY] = unit.sht4.humidity;
+    }
+
+    if (unit.isBmp280Initialised) {
+        values[HISTORY_BMP280_TEMPERATURE] = unit.bmp.cTemp;
+        values[HISTORY_BMP280_PRESSURE] = unit.bmp.pressure;
+    }
+
+    if (unit.isScd4xInitialised) {
+        values[HISTORY_SCD4X_TEMPERATURE] = unit.scd4.getTemperature();
+        values[HISTORY_SCD4X_HUMIDITY] = unit.scd4.getHumidity();
+        values[HISTORY_SCD4X_CO2] = unit.scd4.getCO2();
+    }
+}
+
+void RecordHistorySample() {
+    TRACE_SCOPE("RecordHistorySample");
+
+    // Samples without a real timestamp can't be placed in the history
+    if (!hasRtcSynced) {
+        return;
+    }
+
+    // Only the first unit is kept
+    EnvUnit* unit = GetPrimaryEnvUnit();
+    if (unit == nullptr) {
+        return;
+    }
+
+    HistorySample sample;
+    sample.timestamp = (uint32_t)time(nullptr);
+    GetSensorValues(*unit, sample.values);
+
+    history.Append(sample);
+}
+
+void RecordSensorsAndLinks() {
+    if (!IsRecording()) {
+        return;
+    }
+
+    for (int i = 0; i < GetEnvUnitCount(); i++) {
+        EnvUnit& unit = GetEnvUnit(i);
+
+        // What GetPrimaryEnvUnit and the rules see, so the replay can make the same decisions
+        uint8_t sensorMask = (unit.isSht4xInitialised ? 1 << RECORDING_SENSOR_SHT4X : 0)
+            | (unit.isBmp280Initialised ? 1 << RECORDING_SENSOR_BMP280 : 0)
+            | (unit.isScd4xInitialised ? 1 << RECORDING_SENSOR_SCD4X : 0);
+        RecordUnitState(i, unit.channel, sensorMask);
+
+        float values[HISTORY_FIELD_COUNT];
+        GetSensorValues(unit, values);
+        RecordSensorReadings(i, values);
+    }
+
+    RecordLinkState(RECORDING_LINK_WIFI, WiFi.status());
+    RecordLinkState(RECORDING_LINK_WIFI_CLIENT, isWifiClientConnected);
+    RecordLinkState(RECORDING_LINK_MQTT, mqttClient.state());
+    RecordLinkState(RECORDING_LINK_NTP, hasRtcSynced);
+}
+
+void EvaluateAlerts() {
+    uint32_t timestamp = hasRtcSynced ? (uint32_t)time(nullptr) : 0;
+
+    for (int i = 0; i < GetEnvUnitCount(); i++) {
+        float values[HISTORY_FIELD_COUNT];
+        GetSensorValues(GetEnvUnit(i), values);
+        EvaluateAlertRules(i, values, timestamp);
+    }
+}
+
+// Alerts go out as soon as they are raised, rather than with the next payload
+void SendPendingAlerts() {
+    TRACE_SCOPE("SendPendingAlerts");
+
+    while (HasPendingAlert() && mqttClient.connected()) {
+        const QueuedAlert& alert = PeekAlert();
+
+        JsonDocument doc;
+        doc["device"]["name"] = SECRET_MQTT_DEVICE_NAME;
+        doc["rule"] = alert.rule;
+        doc["state"] = alert.isTriggered ? "triggered" : "cleared";
+        doc["channel"] = alert.channel;
+        doc["field"] = GetRuleFieldName(alert.field);
+        // A rise/fall clearing because its sensor stopped reporting has no value
+        if (isnan(alert.value)) {
+            doc["sensorLost"] = true;
+        } else {
+            doc["value"] = alert.value;
+        }
+
+        if (alert.timestamp != 0) {
+            char timestamp[24];
+            time_t alertTime = alert.timestamp;
+            strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&alertTime));
+            doc["timestamp"] = timestamp;
+        }
+
+        // Left queued to retry on the next loop
+        if (!PublishJson(SECRET_MQTT_TOPIC "/alerts", doc)) {
+            return;
+        }
+
+        PopAlert();
+    }
+}
+
+void DumpHistoryToSerial() {
+    uint32_t now = (uint32_t)time(nullptr);
+
+    Serial.println();
+    Serial.println("timestamp,sht4x_temperature,sht4x_humidity,bmp280_temperature,bmp280_pressure,scd4x_temperature,scd4x_humidity,scd4x_co2");
+
+    HistoryQuery query(history, now - HISTORY_DUMP_SECONDS, now);
+    HistorySample sample;
+    int sampleCount = 0;
+    while (query.Next(sample)) {
+        Serial.print(sample.timestamp);
+        for (int i = 0; i < HISTORY_FIELD_COUNT; i++) {
+            Serial.print(',');
+            if (!isnan(sample.values[i])) {
+                Serial.print(sample.values[i]);
+            }
+        }
+        Serial.println();
+        sampleCount++;
+    }
+
+    Serial.print("History samples dumped: ");
+    Serial.println(sampleCount);
+}
+
+void WriteTraceLineToSerial(const char* line, void*) {
+    Serial.println(line);
+}
+
+void WriteTraceLineToPrint(const char* line, void* context) {
+    Print* print = (Print*)context;
+    print->print(line);
+    print->print('\n');
+}
+
+void DumpTraceToSerial() {
+    SetTracePaused(true);
+    WriteTraceDump(WriteTraceLineToSerial, nullptr);
+    SetTracePaused(false);
+}
+
+void SendTraceToMqtt() {
+    if (!mqttClient.connected()) {
+        Serial.println("Refusing to send trace as MQTT client is disconnected");
+        return;
+    }
+
+    // Pause so the dump doesn't change length between measuring and writing it
+    SetTracePaused(true);
+
+    if (mqttClient.beginPublish(SECRET_MQTT_TOPIC "/trace", MeasureTraceDump(), false)) {
+        BufferingPrint bufferedClient(mqttClient, PUBLISH_WRITE_BUFFER_BYTES);
+        WriteTraceDump(WriteTraceLineToPrint, &bufferedClient);
+        bufferedClient.flush();
+
+        if (mqttClient.endPublish()) {
+            Serial.println("Trace sent successfully.");
+        } else {
+            Serial.println("Failed to send trace.");
+        }
+    } else {
+        Serial.println("Failed to beginPublish trace.");
+    }
+
+    SetTracePaused(false);
+}
+
+// Everything else that writes to serial, or keeps the radio and display busy, stops for the capture
+void StartCaptureMode() {
+    Serial.println("Suspending the display and network for capture");
+
+    history.Flush(true);
+    StopRecording();
+
+    mqttClient.disconnect();
+    wifiClient.stop();
+    WiFi.disconnect(true);
+
+    M5.Display.sleep();
+
+    SetEnvUnitsCaptureSampling(true);
+    StartCapture(hasRtcSynced ? (uint32_t)time(nullptr) : 0);
+}
+
+void StopCaptureMode() {
+    StopCapture();
+    SetEnvUnitsCaptureSampling(false);
+
+    if (!isDisplayAsleep) {
+        M5.Display.wakeup();
+        M5.Display.setBrightness(powerGovernor.GetSettings().displayBrightness);
+    }
+
+    Serial.println("Reconnecting after capture");
+    StartWiFi(true);
+}
+
+// Single character commands from the serial monitor
+void HandleSerialCommands() {
+    while (Serial.available() > 0) {
+        char command = Serial.read();
+
+        // Anything else would write text into the capture stream
+        if (IsCapturing()) {
+            if (command == 'c') {
+                StopCaptureMode();
+            }
+            continue;
+        }
+
+        if (command == 't') {
+            DumpTraceToSerial();
+        } else if (command == 'r') {
+            if (IsRecording()) {
+                StopRecording();
+            } else {
+                StartRecording();
+            }
+        } else if (command == 'd') {
+            DumpRecordingToSerial();
+        } else if (command == 'c') {
+            StartCaptureMode();
+        }
+    }
+}
+
+// Writes out the history and turns off; doesn't return
+void PowerOff() {
+    Serial.println("Power off pressed...");
+    history.Flush(true);
+    StopRecording();
+    delay(500);
+    M5.Power.deepSleep();
+}
+
+// Acts on buttons A and B after M5.update()
+void HandleButtonPresses() {
+    bool hasWokenDisplay = UpdateDisplaySleep();
+
+    if (M5.BtnA.wasPressed() && !hasWokenDisplay) {
+        DumpHistoryToSerial();
+    }
+}
+
+// Waits out the loop delay, checking the buttons and serial as it goes.
+// With M5.update() only called once a loop, presses shorter than the delay would be missed.
+// Returns early if a capture is started, so it begins straight away.
+void WaitForNextLoop(unsigned long delayMillis) {
+    TRACE_SCOPE("delay");
+
+    unsigned long startedAt = millis();
+    while (millis() - startedAt < delayMillis) {
+        delay(min((unsigned long)BUTTON_POLL_INTERVAL_MS, delayMillis - (millis() - startedAt)));
+
+        M5.update();
+        if (M5.BtnPWR.isPressed()) {
+            PowerOff();
+        }
+
+        // Redraw straight away rather than showing the readings from before it slept
+        bool wasDisplayAsleep = isDisplayAsleep;
+        HandleButtonPresses();
+        if (wasDisplayAsleep && !isDisplayAsleep) {
+            WriteToDisplay();
+        }
+
+        HandleSerialCommands();
+        if (IsCapturing()) {
+            return;
+        }
+    }
+}
+
 unsigned int loopCount = 0;
 
 void loop() {
+    // Nothing else runs while capturing, so the sensors are read as often as they allow
+    if (IsCapturing()) {
+        M5.update();
+        if (M5.BtnPWR.isPressed()) {
+            StopCapture();
+            PowerOff();
+        }
+
+        HandleSerialCommands();
+        UpdateCapture();
+        return;
+    }
+
+    TRACE_SCOPE("loop");
+
     Serial.print("Loop: ");
     Serial.println(++loopCount);
 
+    RecordLoop();
+
     // Turn off when the power button is held
-    M5.update();
+    {
+        TRACE_SCOPE("M5.update");
+        M5.update();
+    }
     if (M5.BtnPWR.isPressed()) {
-        Serial.println("Power off pressed...");
-        delay(500);
-        M5.Power.deepSleep();
+        PowerOff();
         return;
     }
 
+    UpdatePowerProfile();
+
+    HandleButtonPresses();
+
+    HandleSerialCommands();
+
+    StartPendingNtpSync();
+
     // Update the sensors
-    if (isBmp280Initialised) {
-        //TODO: Handle case this is unplugged
-        bmp.update();
-    } else{
-        isBmp280Initialised = TryInitialiseBmp280();
+    UpdateEnvUnits();
+
+    EvaluateAlerts();
+    SendPendingAlerts();
+
+    UpdateComfortMetrics();
+
+    RecordHistorySample();
+
+    WriteToSerial();
+
+    WriteToDisplay();
+
+    // Process incoming commands and keep the connection alive
+    {
+        TRACE_SCOPE("mqttClient.loop");
+        mqttClient.loop();
     }
-    
-    if (isSht4xInitialised) {
-        //TODO: Handle case this is unplugged
-        sht4.update();
-    } else {
-        isSht4xInitialised = TryInitialiseSht4x();
+
+    if (isTraceRequested) {
+        isTraceRequested = false;
+        SendTraceToMqtt();
     }
 
-    if (isScd4xInitialised) {
-        scd4.update();
-    } else {
-        isScd4xInitialised = TryInitialiseScd4x();
+    if (isTlsStatsRequested) {
+        isTlsStatsRequested = false;
+        if (mqttClient.connected()) {
+            SendTlsStatsToMqtt();
+        }
     }
 
-    WriteToSerial();
+    if (isRecordingRequested) {
+        isRecordingRequested = false;
+        if (mqttClient.connected()) {
+            SendRecordingToMqtt(mqttClient, SECRET_MQTT_TOPIC "/recording");
+        }
+    }
 
-    WriteToDisplay();
+    RecordSensorsAndLinks();
+
+    LinkStatus link;
+    link.isWifiConnected = isWifiConnected;
+    link.isWifiClientConnected = isWifiClientConnected;
+    link.isMqttConnected = mqttClient.connected();
+    link.hasRtcSynced = hasRtcSynced;
+
+    // Send the first payload as soon as possible, then at the power profile's interval
+    PublishDecision decision = publishScheduler.OnLoop(link, GetPrimaryEnvUnit() != nullptr);
+
+    if (decision == PUBLISH_SEND) {
+        bool isSent = SendSensorPayloadToMqtt();
+        publishScheduler.OnPublishResult(isSent);
+        RecordPublish(decision, isSent);
+    } else if (decision != PUBLISH_NOT_DUE) {
+        PrintPublishRefusal(decision);
+        RecordPublish(decision, false);
+    }
 
-    // Note: this must be less than 20 due to Mosquitto timeout (which I cannot figure out how to change)
-    if (loopCount == 10) {
-        SendSensorPayloadToMqtt();
-        loopCount = 0;
+    if (isPowerProfilePending && !publishScheduler.IsBooting() && mqttClient.connected()) {
+        SendPowerProfileToMqtt();
     }
 
-    delay(1000);
+    bool isFastBootLoop = publishScheduler.IsBooting() && millis() < BOOT_FAST_LOOP_MAX_MS;
+    WaitForNextLoop(isFastBootLoop ? BOOT_LOOP_DELAY_MS : powerGovernor.GetSettings().loopDelayMillis);
 }
@@ -0,0 +1,361 @@
+#!/usr/bin/env python3
+"""Receive a thermo_iot capture and decode it to CSV or Parquet.
+
+Captures from the device over serial (needs pyserial), starting and stopping it,
+or decodes a raw capture saved earlier with --raw:
+
+    python3 tools/capture_receiver.py /dev/ttyUSB0 capture.csv --seconds 600 --raw capture.bin
+    python3 tools/capture_receiver.py capture.bin capture.parquet
+
+Without --seconds the capture runs until Ctrl-C. Parquet output needs pyarrow.
+Throughput and lost frames are reported once the capture ends; see include/Capture.h
+for the frame layout.
+"""
+
+import argparse
+import binascii
+import csv
+import os
+import struct
+import sys
+import time
+
+CAPTURE_BAUD = 1500000
+MONITOR_BAUD = 115200
+CAPTURE_VERSION = 1
+
+# Longer than the slowest power profile's 10s loop delay
+START_TIMEOUT_SECONDS = 15
+START_RESEND_SECONDS = 3
+
+SYNC = b"\xa5\x5a"
+HEADER = struct.Struct("<BBII")
+HEADER_BYTES = 2 + HEADER.size
+CRC_BYTES = 2
+
+FRAME_START = 1
+FRAME_SHT4X = 2
+FRAME_BMP280 = 3
+FRAME_STATUS = 4
+FRAME_END = 5
+
+READING = struct.Struct("<Bff")
+STATUS = struct.Struct("<II")
+START = struct.Struct("<BBI")
+
+WRAP = 1 << 32
+
+COLUMNS = ["sequence", "time_us", "unix_time", "unit", "sensor", "temperature", "humidity", "pressure"]
+
+
+class Decoder:
+    """Splits a byte stream into frames, resynchronising after corruption."""
+
+    def __init__(self):
+        self.buffer = bytearray()
+        self.crc_errors = 0
+        self.skipped_bytes = 0
+
+    def feed(self, data):
+        self.buffer += data
+        frames = []
+
+        while True:
+            start = self.buffer.find(SYNC)
+            if start < 0:
+                # Keep a trailing first sync byte, which may be completed by the next read
+                keep = 1 if self.buffer[-1:] == SYNC[:1] else 0
+                self.skipped_bytes += len(self.buffer) - keep
+                del self.buffer[:len(self.buffer) - keep]
+                break
+
+            self.skipped_bytes += start
+            del self.buffer[:start]
+
+            if len(self.buffer) < HEADER_BYTES:
+                break
+
+            frame_type, length, sequence, timestamp = HEADER.unpack_from(self.buffer, 2)
+            size = HEADER_BYTES + length + CRC_BYTES
+            if len(self.buffer) < size:
+                break
+
+            crc, = struct.unpack_from("<H", self.buffer, HEADER_BYTES + length)
+            if binascii.crc_hqx(bytes(self.buffer[2:HEADER_BYTES + length]), 0xFFFF) != crc:
+                # Not a frame, or a corrupted one; look for the next sync after this one
+                self.crc_errors += 1
+                self.skipped_bytes += 1
+                del self.buffer[:1]
+                continue
+
+            payload = bytes(self.buffer[HEADER_BYTES:HEADER_BYTES + length])
+            frames.append((frame_type, sequence, timestamp, payload))
+            del self.buffer[:size]
+
+        return frames
+
+
+class Capture:
+    """Turns frames into rows and keeps the statistics."""
+
+    def __init__(self):
+        self.rows = []
+        self.frames = 0
+        self.lost_frames = 0
+        self.device_dropped = 0
+        self.failed_reads = 0
+        self.readings = {}
+        self.unix_time = 0
+        self.has_started = False
+        self.has_ended = False
+
+        self.last_sequence = None
+        self.last_timestamp = None
+        self.time_offset = 0
+        self.first_time = None
+        self.last_time = None
+
+    def unwrap(self, timestamp):
+        """Extends micros(), which wraps every ~71 minutes."""
+        if self.last_timestamp is not None and timestamp < self.last_timestamp - WRAP // 2:
+            self.time_offset += WRAP
+        self.last_timestamp = timestamp
+        return timestamp + self.time_offset
+
+    def add(self, frame_type, sequence, timestamp, payload):
+        if frame_type == FRAME_START:
+            version, _, unix_time = START.unpack_from(payload)
+            if version != CAPTURE_VERSION:
+                raise ValueError("Capture version {} isn't supported".format(version))
+
+            # Anything before belongs to an earlier capture
+            self.__init__()
+            self.has_started = True
+            self.unix_time = unix_time
+
+        elif not self.has_started:
+            return
+
+        self.frames += 1
+
+        if self.last_sequence is not None:
+            self.lost_frames += (sequence - self.last_sequence - 1) % WRAP
+        self.last_sequence = sequence
+
+        time_us = self.unwrap(timestamp)
+        if self.first_time is None:
+            self.first_time = time_us
+        self.last_time = time_us
+        time_us -= self.first_time
+
+        if frame_type in (FRAME_STATUS, FRAME_END):
+            self.device_dropped, self.failed_reads = STATUS.unpack_from(payload)
+            self.has_ended = frame_type == FRAME_END
+            return
+
+        if frame_type not in (FRAME_SHT4X, FRAME_BMP280):
+            return
+
+        unit, temperature, second = READING.unpack_from(payload)
+        sensor = "sht4x" if frame_type == FRAME_SHT4X else "bmp280"
+        self.readings[(unit, sensor)] = self.readings.get((unit, sensor), 0) + 1
+
+        self.rows.append({
+            "sequence": sequence,
+            "time_us": time_us,
+            "unix_time": self.unix_time + time_us / 1e6 if self.unix_time else None,
+            "unit": unit,
+            "sensor": sensor,
+            "temperature": temperature,
+            "humidity": second if frame_type == FRAME_SHT4X else None,
+            "pressure": second if frame_type == FRAME_BMP280 else None,
+        })
+
+    def duration(self):
+        if self.first_time is None:
+            return 0.0
+        return (self.last_time - self.first_time) / 1e6
+
+
+def write_csv(path, rows):
+    with open(path, "w", newline="") as output:
+        writer = csv.DictWriter(output, fieldnames=COLUMNS)
+        writer.writeheader()
+        for row in rows:
+            writer.writerow({key: "" if value is None else value for key, value in row.items()})
+
+
+def write_parquet(path, rows):
+    try:
+        import pyarrow
+        import pyarrow.parquet
+    except ImportError:
+        raise SystemExit("Parquet output needs pyarrow (pip install pyarrow)")
+
+    schema = pyarrow.schema([
+        ("sequence", pyarrow.uint32()),
+        ("time_us", pyarrow.uint64()),
+        ("unix_time", pyarrow.float64()),
+        ("unit", pyarrow.uint8()),
+        ("sensor", pyarrow.string()),
+        ("temperature", pyarrow.float32()),
+        ("humidity", pyarrow.float32()),
+        ("pressure", pyarrow.float32()),
+    ])
+    columns = {name: [row[name] for row in rows] for name in COLUMNS}
+    pyarrow.parquet.write_table(pyarrow.table(columns, schema=schema), path)
+
+
+def open_device(port):
+    try:
+        import serial
+    except ImportError:
+        raise SystemExit("Capturing from a device needs pyserial (pip install pyserial)")
+
+    device = serial.Serial()
+    device.port = port
+    device.baudrate = MONITOR_BAUD
+    device.timeout = 0.1
+    # Opening with DTR/RTS asserted would reset the board
+    device.dtr = False
+    device.rts = False
+    device.open()
+    return device
+
+
+def start_capture(device):
+    device.reset_input_buffer()
+
+    # Serial is checked through the loop delay, but a slow loop (a WiFi or TLS connect)
+    # can still take longer than the 10s delay. A 'c' sent again once the device has
+    # started is discarded when it changes baud rate, so resending is safe.
+    deadline = time.monotonic() + START_TIMEOUT_SECONDS
+    resend_at = time.monotonic()
+    while time.monotonic() < deadline:
+        if time.monotonic() >= resend_at:
+            device.write(b"c")
+            resend_at += START_RESEND_SECONDS
+
+        line = device.readline()
+        if b"Capture starting" in line:
+            # The device waits before its first frame, giving time to switch
+            device.baudrate = CAPTURE_BAUD
+            return
+    raise SystemExit("The device didn't start capturing")
+
+
+def receive(device, seconds, raw, decoder, capture):
+    started_at = time.monotonic()
+    last_report_at = started_at
+    received = 0
+
+    def read(size):
+        nonlocal received
+        data = device.read(size)
+        received += len(data)
+        if raw:
+            raw.write(data)
+        for frame in decoder.feed(data):
+            capture.add(*frame)
+
+    try:
+        while seconds is None or time.monotonic() - started_at < seconds:
+            read(max(1, device.in_waiting))
+
+            now = time.monotonic()
+            if now - last_report_at >= 1:
+                last_report_at = now
+                print("\r{} frames, {} lost, {:.1f}KB/s   ".format(
+                    capture.frames, capture.lost_frames, received / (now - started_at) / 1000),
+                    end="", file=sys.stderr)
+    except KeyboardInterrupt:
+        pass
+
+    print(file=sys.stderr)
+    elapsed = time.monotonic() - started_at
+
+    # Stop, and read until the END frame
+    device.write(b"c")
+    deadline = time.monotonic() + 2
+    while not capture.has_ended and time.monotonic() < deadline:
+        read(max(1, device.in_waiting))
+
+    device.baudrate = MONITOR_BAUD
+    return received, elapsed
+
+
+def decode_file(path, decoder, capture):
+    with open(path, "rb") as source:
+        data = source.read()
+    for frame in decoder.feed(data):
+        capture.add(*frame)
+    return len(data)
+
+
+def report(capture, decoder, received, elapsed):
+    duration = capture.duration()
+    expected = capture.frames + capture.lost_frames
+
+    print("Frames: {}".format(capture.frames))
+    print("Lost frames: {} ({:.3f}%)".format(
+        capture.lost_frames, 100.0 * capture.lost_frames / expected if expected else 0.0))
+    print("  dropped on the device: {}".format(capture.device_dropped))
+    print("  lost on the link: {}".format(max(0, capture.lost_frames - capture.device_dropped)))
+    print("CRC errors: {}".format(decoder.crc_errors))
+    print("Skipped bytes: {}".format(decoder.skipped_bytes))
+    print("Failed reads: {}".format(capture.failed_reads))
+    print("Device time: {:.1f}s".format(duration))
+
+    if elapsed:
+        print("Throughput: {:.1f}KB/s, {:.0f} frames/s".format(
+            received / elapsed / 1000, capture.frames / elapsed))
+
+    for (unit, sensor), count in sorted(capture.readings.items()):
+        rate = count / duration if duration else 0.0
+        print("Unit {} {}: {} readings, {:.1f}/s".format(unit, sensor, count, rate))
+
+    if not capture.has_ended:
+        print("No END frame; the capture may be incomplete")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("source", help="serial port, or a raw capture file")
+    parser.add_argument("output", nargs="?", help=".csv or .parquet")
+    parser.add_argument("--seconds", type=float, help="stop the capture after this long")
+    parser.add_argument("--raw", help="also save the raw stream here")
+    args = parser.parse_args()
+
+    decoder = Decoder()
+    capture = Capture()
+
+    if os.path.isfile(args.source):
+        received = decode_file(args.source, decoder, capture)
+        elapsed = None
+    else:
+        device = open_device(args.source)
+        raw = open(args.raw, "wb") if args.raw else None
+        try:
+            start_capture(device)
+            received, elapsed = receive(device, args.seconds, raw, decoder, capture)
+        finally:
+            device.close()
+            if raw:
+                raw.close()
+
+    if not capture.has_started:
+        print("No capture found", file=sys.stderr)
+        return 1
+
+    if args.output:
+        if args.output.endswith(".parquet"):
+            write_parquet(args.output, capture.rows)
+        else:
+            write_csv(args.output, capture.rows)
+
+    report(capture, decoder, received, elapsed)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,178 @@
+// Checks the comfort metric approximations against libm on the host, and times them.
+//
+// Build from the repository root:
+//   g++ -std=gnu++17 -O2 -Ilib/Comfort tools/comfort_check/comfort_check.cpp lib/Comfort/ComfortMetrics.cpp -o comfort_check
+//
+// Run:
+//   ./comfort_check
+//
+// FastLog and FastExp are swept finely enough to cover every table slot, and each metric over
+// the sensors' operating range, against the same formulas evaluated in double with libm.
+// Exits non-zero if any error exceeds the bound documented in ComfortMetrics.h.
+// Timings are for the host only, where libm has fast double precision hardware to work with;
+// the ESP32 has a single precision FPU, so they don't carry over.
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <vector>
+
+#include <ComfortMetrics.h>
+
+// The bounds documented in ComfortMetrics.h
+#define CHECK_LOG_ABSOLUTE_ERROR 3e-6
+#define CHECK_EXP_RELATIVE_ERROR 5e-6
+
+// Sensor ranges: SHT4x -40..125C and 0..100%RH, BMP280 300..1100hPa
+#define CHECK_MIN_TEMPERATURE -40.0f
+#define CHECK_MAX_TEMPERATURE 85.0f
+#define CHECK_MIN_HUMIDITY 1.0f
+#define CHECK_MAX_HUMIDITY 100.0f
+#define CHECK_MIN_PRESSURE 30000.0f
+#define CHECK_MAX_PRESSURE 110000.0f
+#define CHECK_MAX_ALTITUDE 3000.0f
+
+// Far below the sensors' accuracy: SHT4x +-0.2C and +-1.8%RH, BMP280 +-100Pa
+#define CHECK_DEW_POINT_ERROR 0.001
+#define CHECK_ABSOLUTE_HUMIDITY_RELATIVE_ERROR 2e-5
+
+// FastPow is FastExp(exponent * FastLog(base)), so its relative error is bounded by
+// the exp error plus the exponent times the log error
+#define CHECK_SEA_LEVEL_PRESSURE_RELATIVE_ERROR (CHECK_EXP_RELATIVE_ERROR + 5.257 * CHECK_LOG_ABSOLUTE_ERROR)
+
+// Floats stepped over in the log sweep; a table slot spans 32768 floats
+#define CHECK_LOG_FLOAT_STEP 61
+
+// A table slot spans 1/256 of a power of 2, about 0.0027 in x
+#define CHECK_EXP_STEP 1e-5
+
+#define TIMING_CALLS 10000000
+
+static bool isPassing = true;
+
+static void Report(const char* name, double error, double bound, const char* unit) {
+    bool isWithin = error <= bound;
+    isPassing = isPassing && isWithin;
+
+    printf("%-30s max error %.3g%s (bound %.3g%s) %s\n", name, error, unit, bound, unit, isWithin ? "ok" : "FAIL");
+}
+
+// Reference formulas, in double with libm
+static double ReferenceDewPoint(double temperature, double humidity) {
+    double gamma = log(humidity / 100.0) + (17.62 * temperature) / (243.12 + temperature);
+    return (243.12 * gamma) / (17.62 - gamma);
+}
+
+static double ReferenceAbsoluteHumidity(double temperature, double humidity) {
+    double saturationPressure = 6.112 * exp((17.62 * temperature) / (243.12 + temperature));
+    return 216.679 * (saturationPressure * humidity / 100.0) / (273.15 + temperature);
+}
+
+static double ReferenceSeaLevelPressure(double pressure, double temperature, double altitude) {
+    double lapse = 0.0065 * altitude;
+    return pressure * pow(1.0 - lapse / (temperature + lapse + 273.15), -5.257);
+}
+
+// For positive floats, whose bit patterns are in the same order as their values
+static float NextFloat(float x, uint32_t steps) {
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    bits += steps;
+    memcpy(&x, &bits, sizeof(x));
+
+    return x;
+}
+
+static void CheckLog() {
+    double maxError = 0.0;
+
+    // Every slot of the table, in every octave from 1e-6 to 1e6
+    for (float x = 1e-6f; x < 1e6f; x = NextFloat(x, CHECK_LOG_FLOAT_STEP)) {
+        maxError = fmax(maxError, fabs(FastLog(x) - log((double)x)));
+    }
+
+    Report("FastLog", maxError, CHECK_LOG_ABSOLUTE_ERROR, "");
+}
+
+static void CheckExp() {
+    double maxError = 0.0;
+
+    // Beyond this the result underflows or overflows a float
+    for (double step = -80.0; step < 80.0; step += CHECK_EXP_STEP) {
+        float x = (float)step;
+        double reference = exp((double)x);
+        maxError = fmax(maxError, fabs(FastExp(x) - reference) / reference);
+    }
+
+    Report("FastExp (relative)", maxError, CHECK_EXP_RELATIVE_ERROR, "");
+}
+
+static void CheckMetrics() {
+    double dewPointError = 0.0;
+    double absoluteHumidityError = 0.0;
+    double seaLevelPressureError = 0.0;
+
+    for (float t = CHECK_MIN_TEMPERATURE; t <= CHECK_MAX_TEMPERATURE; t += 0.1f) {
+        for (float rh = CHECK_MIN_HUMIDITY; rh <= CHECK_MAX_HUMIDITY; rh += 0.25f) {
+            dewPointError = fmax(dewPointError, fabs(CalculateDewPoint(t, rh) - ReferenceDewPoint(t, rh)));
+
+            double reference = ReferenceAbsoluteHumidity(t, rh);
+            absoluteHumidityError = fmax(absoluteHumidityError,
+                fabs(CalculateAbsoluteHumidity(t, rh) - reference) / reference);
+        }
+
+        for (float p = CHECK_MIN_PRESSURE; p <= CHECK_MAX_PRESSURE; p += 500.0f) {
+            for (float altitude = 0.0f; altitude <= CHECK_MAX_ALTITUDE; altitude += 50.0f) {
+                double reference = ReferenceSeaLevelPressure(p, t, altitude);
+                seaLevelPressureError = fmax(seaLevelPressureError,
+                    fabs(CalculateSeaLevelPressure(p, t, altitude) - reference) / reference);
+            }
+        }
+    }
+
+    Report("Dew point", dewPointError, CHECK_DEW_POINT_ERROR, "C");
+    Report("Absolute humidity (relative)", absoluteHumidityError, CHECK_ABSOLUTE_HUMIDITY_RELATIVE_ERROR, "");
+    Report("Sea level pressure (relative)", seaLevelPressureError, CHECK_SEA_LEVEL_PRESSURE_RELATIVE_ERROR, "");
+}
+
+// Returns nanoseconds per call. The inputs vary so the calls can't be hoisted.
+template <typename Function>
+static double TimeCalls(const std::vector<float>& inputs, Function function) {
+    volatile float sink = 0.0f;
+
+    auto startedAt = std::chrono::steady_clock::now();
+    for (int i = 0; i < TIMING_CALLS; i++) {
+        sink = sink + function(inputs[i % inputs.size()]);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - startedAt;
+
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / TIMING_CALLS;
+}
+
+static void CompareTimings() {
+    std::vector<float> logInputs;
+    std::vector<float> expInputs;
+    for (int i = 0; i < 1024; i++) {
+        logInputs.push_back(0.01f + i * 0.001f);
+        expInputs.push_back(-5.0f + i * 0.01f);
+    }
+
+    printf("\n%-12s %10s %10s\n", "", "table", "libm");
+    printf("%-12s %8.1fns %8.1fns\n", "log", TimeCalls(logInputs, FastLog), TimeCalls(logInputs, logf));
+    printf("%-12s %8.1fns %8.1fns\n", "exp", TimeCalls(expInputs, FastExp), TimeCalls(expInputs, expf));
+    printf("%-12s %8.1fns %8.1fns\n", "pow",
+        TimeCalls(logInputs, [](float x) { return FastPow(x, -5.257f); }),
+        TimeCalls(logInputs, [](float x) { return powf(x, -5.257f); }));
+}
+
+int main() {
+    CheckLog();
+    CheckExp();
+    CheckMetrics();
+    CompareTimings();
+
+    return isPassing ? 0 : 1;
+}
@@ -0,0 +1,176 @@
+// Measures the history codec's compression ratio and encode/decode speed on the host.
+//
+// Build from the repository root:
+//   g++ -std=gnu++17 -O2 -Ilib/Trace -Ilib/TimeSeries tools/history_bench/history_bench.cpp lib/TimeSeries/TimeSeriesCodec.cpp -o history_bench
+//
+// Run:
+//   ./history_bench
+//
+// A day of synthetic indoor samples at one per second is encoded into 2KB chunks,
+// as the device does, then decoded and checked bit for bit against the input.
+// Readings are quantised as each sensor's driver reports them: the SHT4x in 16 bit ticks,
+// the BMP280 temperature in hundredths and pressure in 1/256 Pa, and the SCD4x only
+// updating every 5 seconds with whole ppm.
+// Host timings only give the relative cost; the ESP32 is roughly 20-50x slower.
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include <TimeSeriesCodec.h>
+
+#define BENCH_SAMPLES (24 * 60 * 60)
+#define BENCH_START_TIMESTAMP 1760000000UL
+
+// Without the header, a sample is a timestamp and 7 floats
+#define BENCH_RAW_SAMPLE_BYTES (4 + HISTORY_FIELD_COUNT * 4)
+
+struct EncodedChunk {
+    HistoryChunkHeader header;
+    std::vector<uint8_t> data;
+};
+
+static float QuantiseSht4xTemperature(float celsius) {
+    float ticks = roundf((celsius + 45.0f) * 65535.0f / 175.0f);
+    return -45.0f + 175.0f * ticks / 65535.0f;
+}
+
+static float QuantiseSht4xHumidity(float humidity) {
+    float ticks = roundf((humidity + 6.0f) * 65535.0f / 125.0f);
+    return -6.0f + 125.0f * ticks / 65535.0f;
+}
+
+static float QuantiseScd4xTemperature(float celsius) {
+    float ticks = roundf((celsius + 45.0f) * 65536.0f / 175.0f);
+    return -45.0f + 175.0f * ticks / 65536.0f;
+}
+
+static float QuantiseScd4xHumidity(float humidity) {
+    float ticks = roundf(humidity * 65536.0f / 100.0f);
+    return 100.0f * ticks / 65536.0f;
+}
+
+// Slow daily drift with sensor noise, and the SCD4x holding each reading for 5 seconds
+static std::vector<HistorySample> GenerateSamples(bool hasScd4x) {
+    std::mt19937 random(1);
+    std::normal_distribution<float> noise(0.0f, 1.0f);
+
+    std::vector<HistorySample> samples(BENCH_SAMPLES);
+    float co2 = 600.0f;
+
+    for (int i = 0; i < BENCH_SAMPLES; i++) {
+        HistorySample& sample = samples[i];
+        sample.timestamp = BENCH_START_TIMESTAMP + i;
+
+        float dayPhase = 2.0f * (float)M_PI * i / BENCH_SAMPLES;
+        float temperature = 21.0f + 1.5f * sinf(dayPhase);
+        float humidity = 45.0f - 5.0f * sinf(dayPhase);
+
+        sample.values[HISTORY_SHT4X_TEMPERATURE] = QuantiseSht4xTemperature(temperature + 0.01f * noise(random));
+        sample.values[HISTORY_SHT4X_HUMIDITY] = QuantiseSht4xHumidity(humidity + 0.02f * noise(random));
+        sample.values[HISTORY_BMP280_TEMPERATURE] = roundf((temperature + 0.5f + 0.01f * noise(random)) * 100.0f) / 100.0f;
+        sample.values[HISTORY_BMP280_PRESSURE] = roundf((101325.0f + 150.0f * sinf(dayPhase / 2.0f) + 1.5f * noise(random)) * 256.0f) / 256.0f;
+
+        if (!hasScd4x) {
+            sample.values[HISTORY_SCD4X_TEMPERATURE] = NAN;
+            sample.values[HISTORY_SCD4X_HUMIDITY] = NAN;
+            sample.values[HISTORY_SCD4X_CO2] = NAN;
+        } else if (i % 5 == 0 || i == 0) {
+            co2 += (600.0f + 300.0f * sinf(dayPhase * 3.0f) - co2) * 0.05f + 2.0f * noise(random);
+            sample.values[HISTORY_SCD4X_TEMPERATURE] = QuantiseScd4xTemperature(temperature + 1.0f + 0.02f * noise(random));
+            sample.values[HISTORY_SCD4X_HUMIDITY] = QuantiseScd4xHumidity(humidity - 2.0f + 0.05f * noise(random));
+            sample.values[HISTORY_SCD4X_CO2] = roundf(co2);
+        } else {
+            for (int field = HISTORY_SCD4X_TEMPERATURE; field <= HISTORY_SCD4X_CO2; field++) {
+                sample.values[field] = samples[i - 1].values[field];
+            }
+        }
+    }
+
+    return samples;
+}
+
+static bool IsSameSample(const HistorySample& first, const HistorySample& second) {
+    return first.timestamp == second.timestamp
+        && memcmp(first.values, second.values, sizeof(first.values)) == 0;
+}
+
+// Returns false if the decoded samples don't match
+static bool RunBench(const char* name, bool hasScd4x) {
+    std::vector<HistorySample> samples = GenerateSamples(hasScd4x);
+    std::vector<EncodedChunk> chunks;
+
+    uint8_t buffer[HISTORY_CHUNK_BYTES];
+    HistoryChunkEncoder encoder(buffer, sizeof(buffer));
+
+    auto encodeStartedAt = std::chrono::steady_clock::now();
+
+    for (const HistorySample& sample : samples) {
+        if (encoder.Append(sample)) {
+            continue;
+        }
+
+        chunks.push_back({ encoder.Header(), std::vector<uint8_t>(buffer, buffer + encoder.SizeBytes()) });
+        encoder.Reset();
+        encoder.Append(sample);
+    }
+    chunks.push_back({ encoder.Header(), std::vector<uint8_t>(buffer, buffer + encoder.SizeBytes()) });
+
+    auto encodeElapsed = std::chrono::steady_clock::now() - encodeStartedAt;
+
+    std::vector<HistorySample> decoded;
+    decoded.reserve(samples.size());
+
+    auto decodeStartedAt = std::chrono::steady_clock::now();
+
+    HistoryChunkDecoder decoder;
+    for (const EncodedChunk& chunk : chunks) {
+        decoder.Reset(chunk.header, chunk.data.data());
+
+        HistorySample sample;
+        while (decoder.Next(sample)) {
+            decoded.push_back(sample);
+        }
+    }
+
+    auto decodeElapsed = std::chrono::steady_clock::now() - decodeStartedAt;
+
+    bool isMatching = decoded.size() == samples.size();
+    for (size_t i = 0; isMatching && i < samples.size(); i++) {
+        isMatching = IsSameSample(samples[i], decoded[i]);
+    }
+
+    size_t dataBytes = 0;
+    for (const EncodedChunk& chunk : chunks) {
+        dataBytes += chunk.data.size();
+    }
+
+    // On flash each chunk takes its header and a full 2KB
+    size_t storedBytes = chunks.size() * (sizeof(HistoryChunkHeader) + HISTORY_CHUNK_BYTES);
+
+    double encodeNanos = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(encodeElapsed).count();
+    double decodeNanos = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(decodeElapsed).count();
+    double sampleCount = (double)samples.size();
+
+    printf("%s\n", name);
+    printf("  Samples: %zu in %zu chunks\n", samples.size(), chunks.size());
+    printf("  Encoded: %.2f bytes per sample, %.1fx smaller than %d bytes\n",
+        dataBytes / sampleCount, BENCH_RAW_SAMPLE_BYTES * sampleCount / dataBytes, BENCH_RAW_SAMPLE_BYTES);
+    printf("  Stored with headers and chunk padding: %.2f bytes per sample\n", storedBytes / sampleCount);
+    printf("  Encode: %.1fns per sample, %.1fM samples/s\n", encodeNanos / sampleCount, sampleCount * 1000.0 / encodeNanos);
+    printf("  Decode: %.1fns per sample, %.1fM samples/s\n", decodeNanos / sampleCount, sampleCount * 1000.0 / decodeNanos);
+    printf("  Round trip: %s\n", isMatching ? "exact" : "MISMATCH");
+
+    return isMatching;
+}
+
+int main() {
+    bool isMatching = RunBench("ENV unit with SCD4x", true);
+    isMatching = RunBench("ENV unit without SCD4x", false) && isMatching;
+
+    return isMatching ? 0 : 1;
+}
@@ -0,0 +1,319 @@
+// Runs the power governor against a simulated battery on the host.
+//
+// Build from the repository root:
+//   g++ -std=gnu++17 -O2 -Ilib/Trace -Ilib/Power tools/power_sim/power_sim.cpp lib/Power/PowerGovernor.cpp -o power_sim
+//
+// Run:
+//   ./power_sim            profile changes, a summary and the checks
+//   ./power_sim --csv      the battery level and profile each minute
+//
+// The battery is discharged from full until empty, recharged for an hour with the
+// charge state unknown (as on the StickC Plus2), then discharged again.
+// Each profile's current draw is estimated from its settings, so the runtime is only
+// indicative; it is compared against staying in the performance profile throughout.
+//
+// Then checks, exiting non-zero if any fails, that:
+//   - the noisy discharge and a level hovering at a threshold never step back up
+//   - a level recovering without charging only steps up past the hysteresis
+//   - charging is detected within SIM_CHARGE_DETECT_MAX_SAMPLES, or at once when known
+//   - each lower profile runs longer on a full battery, and the governed discharge
+//     outlasts the performance profile
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <random>
+
+#include <PowerGovernor.h>
+
+// StickC Plus2
+#define SIM_CAPACITY_MAH 200.0
+
+#define SIM_CHARGE_MA 200.0
+#define SIM_CHARGE_MILLIS (60 * 60 * 1000UL)
+
+// Rough ESP32 draw in each WiFi power save mode
+#define SIM_WIFI_NONE_MA 100.0
+#define SIM_WIFI_MIN_MA 45.0
+#define SIM_WIFI_MAX_MA 25.0
+
+// Backlight at full brightness
+#define SIM_BACKLIGHT_MA 40.0
+
+// Each publish keeps the radio fully on for about this long
+#define SIM_PUBLISH_MA 100.0
+#define SIM_PUBLISH_MILLIS 300.0
+
+// The display is woken this often, for the display timeout
+#define SIM_BUTTON_INTERVAL_MILLIS (30 * 60 * 1000.0)
+
+// The level is read from the battery voltage, which sags and jumps under load
+#define SIM_LEVEL_NOISE_PERCENT 2.0
+
+// The rate needs two full windows; allow a third, sampled at the critical profile's loop delay
+#define SIM_CHARGE_DETECT_MAX_SAMPLES (3 * POWER_RATE_WINDOW_MS / 10000)
+
+#define SIM_HOVER_HOURS 4.0
+
+// Slower than POWER_CHARGING_RATE, as the voltage recovers when a load is removed or it warms up
+#define SIM_RECOVERY_PERCENT_PER_HOUR 3.0
+
+static bool isPassing = true;
+
+static void Check(bool condition, const char* description) {
+    printf("%-56s %s\n", description, condition ? "ok" : "FAIL");
+    isPassing = isPassing && condition;
+}
+
+static double GetProfileCurrent(const PowerProfileSettings& settings) {
+    double current = SIM_WIFI_MIN_MA;
+    if (settings.wifiPowerSave == WIFI_POWER_SAVE_NONE) {
+        current = SIM_WIFI_NONE_MA;
+    } else if (settings.wifiPowerSave == WIFI_POWER_SAVE_MAX) {
+        current = SIM_WIFI_MAX_MA;
+    }
+
+    double displayDuty = 1.0;
+    if (settings.displayTimeoutMillis != 0) {
+        displayDuty = fmin(1.0, settings.displayTimeoutMillis / SIM_BUTTON_INTERVAL_MILLIS);
+    }
+    current += SIM_BACKLIGHT_MA * settings.displayBrightness / 255.0 * displayDuty;
+
+    double publishIntervalMillis = (double)settings.loopDelayMillis * settings.publishIntervalLoops;
+    current += SIM_PUBLISH_MA * SIM_PUBLISH_MILLIS / publishIntervalMillis;
+
+    return current;
+}
+
+struct SimResult {
+    double runtimeHours;
+    double profileHours[POWER_PROFILE_COUNT];
+    int profileChanges;
+    int stepUps;
+};
+
+static int ReadLevel(double percent, std::normal_distribution<double>& noise, std::mt19937& random) {
+    return (int)lround(fmax(0.0, fmin(100.0, percent + noise(random))));
+}
+
+// Discharges from full until empty. If governor is null the performance profile is used throughout.
+static SimResult Discharge(PowerGovernor* governor, uint32_t& millis, bool isCsv, std::mt19937& random) {
+    std::normal_distribution<double> noise(0.0, SIM_LEVEL_NOISE_PERCENT / 2.0);
+
+    SimResult result = {};
+    uint32_t startMillis = millis;
+    double charge = SIM_CAPACITY_MAH;
+    uint32_t nextCsvMillis = millis;
+
+    while (charge > 0.0) {
+        PowerProfile profile = POWER_PROFILE_PERFORMANCE;
+
+        if (governor != nullptr) {
+            BatteryStatus battery;
+            battery.level = ReadLevel(charge / SIM_CAPACITY_MAH * 100.0, noise, random);
+            battery.isCharging = false;
+            battery.isChargeKnown = false;
+
+            PowerProfile before = governor->GetProfile();
+            if (governor->Update(millis, battery)) {
+                result.profileChanges++;
+                if (governor->GetProfile() < before) {
+                    result.stepUps++;
+                }
+
+                if (!isCsv) {
+                    printf("%7.2fh %3d%% %s -> %s", (millis - startMillis) / 3600000.0, battery.level,
+                        GetPowerProfileSettings(before).name, governor->GetSettings().name);
+                    if (governor->HasDischargeRate()) {
+                        printf(" (%.1f%%/h)", governor->GetDischargeRate());
+                    }
+                    printf("\n");
+                }
+            }
+
+            profile = governor->GetProfile();
+
+            if (isCsv && millis >= nextCsvMillis) {
+                printf("%.3f,%.1f,%d,%s,%.2f\n", (millis - startMillis) / 3600000.0,
+                    charge / SIM_CAPACITY_MAH * 100.0, battery.level, governor->GetSettings().name,
+                    governor->HasDischargeRate() ? governor->GetDischargeRate() : NAN);
+                nextCsvMillis += 60 * 1000;
+            }
+        }
+
+        const PowerProfileSettings& settings = GetPowerProfileSettings(profile);
+        uint32_t stepMillis = settings.loopDelayMillis;
+
+        charge -= GetProfileCurrent(settings) * stepMillis / 3600000.0;
+        result.profileHours[profile] += stepMillis / 3600000.0;
+        millis += stepMillis;
+    }
+
+    result.runtimeHours = (millis - startMillis) / 3600000.0;
+    return result;
+}
+
+struct ChargeResult {
+    double detectedHours;
+    int detectedSamples;
+};
+
+// Charges for SIM_CHARGE_MILLIS from empty.
+// Returns the time and samples taken to switch to the performance profile, or -1.
+static ChargeResult Charge(PowerGovernor& governor, uint32_t& millis, bool isChargeKnown, std::mt19937& random) {
+    std::normal_distribution<double> noise(0.0, SIM_LEVEL_NOISE_PERCENT / 2.0);
+
+    uint32_t startMillis = millis;
+    double charge = 0.0;
+    ChargeResult result = { -1.0, -1 };
+    int samples = 0;
+
+    while (millis - startMillis < SIM_CHARGE_MILLIS) {
+        BatteryStatus battery;
+        battery.level = ReadLevel(charge / SIM_CAPACITY_MAH * 100.0, noise, random);
+        battery.isCharging = isChargeKnown;
+        battery.isChargeKnown = isChargeKnown;
+
+        governor.Update(millis, battery);
+        samples++;
+
+        if (result.detectedSamples < 0 && governor.GetProfile() == POWER_PROFILE_PERFORMANCE) {
+            result.detectedHours = (millis - startMillis) / 3600000.0;
+            result.detectedSamples = samples;
+        }
+
+        uint32_t stepMillis = governor.GetSettings().loopDelayMillis;
+        charge = fmin(SIM_CAPACITY_MAH, charge + SIM_CHARGE_MA * stepMillis / 3600000.0);
+        millis += stepMillis;
+    }
+
+    return result;
+}
+
+struct LevelResult {
+    int profileChanges;
+    int stepUps;
+    // Step ups made below the target profile's threshold plus the hysteresis
+    int earlyStepUps;
+    // Level read when the last step up was made, or -1
+    int stepUpLevel;
+};
+
+// Runs a governor from full through a level which follows levelAt(hours), with the
+// charge state unknown. The governor first steps down to the level's profile.
+template <typename LevelFunction>
+static LevelResult FollowLevel(double hours, LevelFunction levelAt, std::mt19937& random) {
+    std::normal_distribution<double> noise(0.0, SIM_LEVEL_NOISE_PERCENT / 2.0);
+
+    PowerGovernor governor;
+    LevelResult result = { 0, 0, 0, -1 };
+    uint32_t millis = 0;
+
+    while (millis < hours * 3600000.0) {
+        BatteryStatus battery;
+        battery.level = ReadLevel(levelAt(millis / 3600000.0), noise, random);
+        battery.isCharging = false;
+        battery.isChargeKnown = false;
+
+        PowerProfile before = governor.GetProfile();
+        if (governor.Update(millis, battery)) {
+            result.profileChanges++;
+
+            PowerProfile after = governor.GetProfile();
+            if (after < before) {
+                result.stepUps++;
+                result.stepUpLevel = battery.level;
+
+                int minPercent = after == POWER_PROFILE_BALANCED ? POWER_BALANCED_MIN_PERCENT
+                    : after == POWER_PROFILE_SAVER ? POWER_SAVER_MIN_PERCENT
+                    : 101;
+                if (battery.level < minPercent + POWER_HYSTERESIS_PERCENT) {
+                    result.earlyStepUps++;
+                }
+            }
+        }
+
+        millis += governor.GetSettings().loopDelayMillis;
+    }
+
+    return result;
+}
+
+int main(int argc, char** argv) {
+    bool isCsv = argc > 1 && strcmp(argv[1], "--csv") == 0;
+
+    std::mt19937 random(1);
+    uint32_t millis = 0;
+
+    if (isCsv) {
+        printf("hours,charge_percent,level,profile,discharge_rate\n");
+    }
+
+    PowerGovernor governor;
+    SimResult governed = Discharge(&governor, millis, isCsv, random);
+
+    ChargeResult charged = Charge(governor, millis, false, random);
+
+    if (isCsv) {
+        return 0;
+    }
+
+    uint32_t baselineMillis = 0;
+    SimResult baseline = Discharge(nullptr, baselineMillis, false, random);
+
+    printf("\n");
+    printf("Runtime: %.2fh governed, %.2fh in performance\n", governed.runtimeHours, baseline.runtimeHours);
+    printf("Profile changes: %d\n", governed.profileChanges);
+
+    for (int i = 0; i < POWER_PROFILE_COUNT; i++) {
+        const PowerProfileSettings& settings = GetPowerProfileSettings((PowerProfile)i);
+        printf("  %-12s %6.2fh  ~%.0fmA\n", settings.name, governed.profileHours[i], GetProfileCurrent(settings));
+    }
+
+    if (charged.detectedSamples >= 0) {
+        printf("Charging detected after %.2fh, %d samples\n", charged.detectedHours, charged.detectedSamples);
+    } else {
+        printf("Charging not detected\n");
+    }
+
+    // Held exactly at a threshold, the noise alone crosses it both ways
+    LevelResult hover = FollowLevel(SIM_HOVER_HOURS,
+        [](double) { return (double)POWER_BALANCED_MIN_PERCENT; }, random);
+
+    // From just below a threshold to well past its hysteresis, slower than charging
+    double recoveryStart = POWER_BALANCED_MIN_PERCENT - 2.0;
+    double recoveryHours = (POWER_HYSTERESIS_PERCENT + 6.0) / SIM_RECOVERY_PERCENT_PER_HOUR;
+    LevelResult recovery = FollowLevel(recoveryHours,
+        [recoveryStart](double hours) { return recoveryStart + hours * SIM_RECOVERY_PERCENT_PER_HOUR; }, random);
+
+    PowerGovernor knownGovernor;
+    uint32_t knownMillis = 0;
+    ChargeResult knownCharged = Charge(knownGovernor, knownMillis, true, random);
+
+    printf("Hovering at %d%%: %d changes, %d step ups\n",
+        POWER_BALANCED_MIN_PERCENT, hover.profileChanges, hover.stepUps);
+    printf("Recovering from %.0f%%: %d changes, stepped up at %d%%\n",
+        recoveryStart, recovery.profileChanges, recovery.stepUpLevel);
+
+    printf("\n");
+    Check(governed.stepUps == 0, "Noisy discharge never steps back up");
+    Check(governed.profileChanges <= POWER_PROFILE_COUNT - 1, "Noisy discharge steps down at most once per profile");
+    Check(hover.stepUps == 0 && hover.profileChanges <= 2, "Level at a threshold doesn't flap");
+    Check(recovery.stepUps == 1 && recovery.earlyStepUps == 0, "Recovery steps up once, past the hysteresis");
+    Check(charged.detectedSamples >= 0 && charged.detectedSamples <= (int)SIM_CHARGE_DETECT_MAX_SAMPLES,
+        "Unknown charging detected within the sample limit");
+    Check(knownCharged.detectedSamples == 1, "Known charging detected on the first sample");
+
+    bool isRuntimeLonger = true;
+    for (int i = 1; i < POWER_PROFILE_COUNT; i++) {
+        double current = GetProfileCurrent(GetPowerProfileSettings((PowerProfile)i));
+        double previousCurrent = GetProfileCurrent(GetPowerProfileSettings((PowerProfile)(i - 1)));
+        isRuntimeLonger = isRuntimeLonger && SIM_CAPACITY_MAH / current > SIM_CAPACITY_MAH / previousCurrent;
+    }
+    Check(isRuntimeLonger, "Each lower profile runs longer on a full battery");
+    Check(governed.runtimeHours > baseline.runtimeHours, "Governed discharge outlasts performance");
+
+    return isPassing ? 0 : 1;
+}
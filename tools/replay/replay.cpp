@@ -0,0 +1,589 @@
+// Replays a device recording through the firmware's per-loop decisions on the host.
+//
+// Build from the repository root:
+//   g++ -std=gnu++17 -O2 -Iinclude -Ilib/Comfort -Ilib/Publish -Ilib/Recording -Ilib/Rules -Ilib/TimeSeries -Ilib/Trace
+//       tools/replay/replay.cpp lib/Comfort/ComfortMetrics.cpp lib/Publish/ConnectPacer.cpp
+//       lib/Publish/PublishScheduler.cpp lib/Recording/Recording.cpp lib/Rules/RuleEngine.cpp
+//       lib/TimeSeries/TimeSeriesCodec.cpp -o replay
+//
+// Run:
+//   ./replay recording.bin [rules file]
+//
+// The recording can be the raw file (from <topic>/recording) or a serial log
+// containing the hex dump printed by the 'd' command.
+// Replay runs as fast as the host allows, using the recorded timestamps.
+// The metrics are printed as JSON so runs against different firmware revisions
+// can be diffed.
+//
+// Each recorded loop is run through the same libraries as loop():
+//   - the recorded readings through the alert rules (lib/Rules), by channel, with the
+//     given rules or the firmware's defaults
+//   - the primary unit's readings through the comfort metrics (lib/Comfort) and, once
+//     the time is synced, the history encoder (lib/TimeSeries)
+//   - the connections to the broker through the connect pacing (lib/Publish)
+//   - the publish gating (lib/Publish), on the replayed connections
+//
+// WiFi association and NTP are fed in as recorded. The broker is taken to accept a
+// connection attempt whenever the recorded firmware was connected to it at that time,
+// so slower pacing shows up as later reconnects, but faster pacing can't connect any
+// sooner than the recorded firmware did.
+// A publish the recorded firmware didn't also send is assumed to succeed if the
+// replayed MQTT connection is up.
+// The "recorded" metrics are counted from the recording, as a baseline to compare with.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Only for ALERT_DEFAULT_RULES, which has no Arduino dependencies
+#include <Alerts.h>
+#include <ComfortMetrics.h>
+#include <ConnectPacer.h>
+#include <PublishScheduler.h>
+#include <Recording.h>
+#include <RuleEngine.h>
+#include <TimeSeriesCodec.h>
+
+#define HEX_DUMP_HEADER "# thermo_iot recording"
+#define HEX_DUMP_FOOTER "# end recording"
+
+// The recording has no wall clock time, so history timestamps count from here
+#define REPLAY_HISTORY_EPOCH 1700000000UL
+
+struct ReplayMetrics {
+    uint32_t durationMillis = 0;
+    uint32_t loops = 0;
+
+    uint32_t publishesSent = 0;
+    uint32_t publishesFailed = 0;
+    uint32_t refusedDisconnected = 0;
+    uint32_t refusedNotSynced = 0;
+    uint32_t refusedNoData = 0;
+
+    int64_t firstPublishMillis = -1;
+    std::vector<uint32_t> publishIntervals;
+
+    uint32_t loopsWithoutSensorData = 0;
+
+    uint32_t alertsTriggered = 0;
+    uint32_t alertsCleared = 0;
+
+    uint32_t historySamples = 0;
+    uint32_t historyChunks = 0;
+    uint32_t historyBytes = 0;
+
+    float dewPointMin = NAN;
+    float dewPointMax = NAN;
+
+    uint32_t wifiClientAttempts = 0;
+    uint32_t wifiClientFailures = 0;
+    uint32_t mqttAttempts = 0;
+    uint32_t mqttFailures = 0;
+    uint32_t mqttReconnects = 0;
+    uint32_t mqttOutageMillis = 0;
+
+    // Counted from the recording, not replayed
+    uint32_t recordedPublishesSent = 0;
+    uint32_t recordedWifiReconnects = 0;
+    uint32_t recordedMqttReconnects = 0;
+    uint32_t recordedMqttOutageMillis = 0;
+    uint32_t recordedI2cErrors = 0;
+};
+
+static bool ReadFile(const char* path, std::vector<uint8_t>& data) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+// Pulls the bytes out of a serial log hex dump. Monitor prefixes before the hex are ignored.
+static bool DecodeHexDump(const std::vector<uint8_t>& text, std::vector<uint8_t>& data) {
+    std::istringstream lines(std::string(text.begin(), text.end()));
+    std::string line;
+    bool isInDump = false;
+
+    data.clear();
+
+    while (std::getline(lines, line)) {
+        if (line.find(HEX_DUMP_HEADER) != std::string::npos) {
+            // Only the last dump in the log is used
+            data.clear();
+            isInDump = true;
+            continue;
+        }
+
+        if (!isInDump) {
+            continue;
+        }
+
+        if (line.find(HEX_DUMP_FOOTER) != std::string::npos) {
+            isInDump = false;
+            continue;
+        }
+
+        // The hex is the last word on the line
+        size_t end = line.find_last_not_of(" \r\n\t");
+        if (end == std::string::npos) {
+            continue;
+        }
+        size_t start = line.find_last_of(" \t", end);
+        start = start == std::string::npos ? 0 : start + 1;
+        std::string hex = line.substr(start, end - start + 1);
+
+        for (size_t i = 0; i + 1 < hex.size(); i += 2) {
+            data.push_back((uint8_t)strtoul(hex.substr(i, 2).c_str(), nullptr, 16));
+        }
+    }
+
+    return !data.empty();
+}
+
+struct ReplayLoop {
+    bool isActive = false;
+    uint32_t millis = 0;
+    bool hasRecordedPublish = false;
+    uint8_t recordedDecision = 0;
+    bool recordedIsSent = false;
+};
+
+struct ReplayUnit {
+    bool hasState = false;
+    uint8_t channel = 0;
+    uint8_t sensorMask = 0;
+    float values[RECORDING_FIELD_COUNT];
+
+    ReplayUnit() {
+        for (int i = 0; i < RECORDING_FIELD_COUNT; i++) {
+            values[i] = NAN;
+        }
+    }
+};
+
+// Tracks reconnects and time without the broker after the first connection
+struct OutageCounter {
+    bool isConnected = false;
+    bool hasConnected = false;
+    uint32_t lostMillis = 0;
+
+    void Update(uint32_t millis, bool isNowConnected, uint32_t& reconnects, uint32_t& outageMillis) {
+        if (isNowConnected && !isConnected) {
+            if (hasConnected) {
+                reconnects++;
+                outageMillis += millis - lostMillis;
+            }
+            hasConnected = true;
+        } else if (!isNowConnected && isConnected) {
+            lostMillis = millis;
+        }
+
+        isConnected = isNowConnected;
+    }
+
+    void Finish(uint32_t millis, uint32_t& outageMillis) {
+        if (!isConnected && hasConnected) {
+            outageMillis += millis - lostMillis;
+        }
+    }
+};
+
+class Replay {
+public:
+    Replay() : historyEncoder(historyChunk, sizeof(historyChunk)) {
+    }
+
+    bool LoadRules(const char* text, int& errorLine) {
+        ruleEngine.SetAlertSink(CountAlert, &metrics);
+        return ruleEngine.LoadConfig(text, errorLine);
+    }
+
+    void OnEvent(const RecordingEvent& event) {
+        if (!hasStarted) {
+            startMillis = event.millis;
+            hasStarted = true;
+        }
+        lastMillis = event.millis;
+
+        switch (event.type) {
+            case RECORD_LOOP:
+                FinishLoop();
+                currentLoop = ReplayLoop();
+                currentLoop.isActive = true;
+                currentLoop.millis = event.millis;
+                break;
+
+            case RECORD_UNIT_STATE:
+                GetUnit(event.unit).hasState = true;
+                GetUnit(event.unit).channel = event.channel;
+                GetUnit(event.unit).sensorMask = event.sensorMask;
+                break;
+
+            case RECORD_SENSOR_READINGS:
+                memcpy(GetUnit(event.unit).values, event.values, sizeof(event.values));
+                break;
+
+            case RECORD_I2C_ERROR:
+                metrics.recordedI2cErrors++;
+                break;
+
+            case RECORD_LINK_STATE:
+                OnLinkState(event);
+                break;
+
+            case RECORD_PUBLISH:
+                currentLoop.hasRecordedPublish = true;
+                currentLoop.recordedDecision = event.decision;
+                currentLoop.recordedIsSent = event.isSent;
+
+                if (event.isSent) {
+                    metrics.recordedPublishesSent++;
+                }
+                break;
+        }
+    }
+
+    const ReplayMetrics& Finish() {
+        FinishLoop();
+
+        recordedMqtt.Finish(lastMillis, metrics.recordedMqttOutageMillis);
+        replayedMqtt.Finish(lastMillis, metrics.mqttOutageMillis);
+
+        if (!historyEncoder.IsEmpty()) {
+            metrics.historyChunks++;
+            metrics.historyBytes += sizeof(HistoryChunkHeader) + historyEncoder.SizeBytes();
+        }
+
+        metrics.durationMillis = lastMillis - startMillis;
+        return metrics;
+    }
+
+private:
+    static void CountAlert(const RuleAlert& alert, void* context) {
+        ReplayMetrics* metrics = (ReplayMetrics*)context;
+
+        if (alert.isTriggered) {
+            metrics->alertsTriggered++;
+        } else {
+            metrics->alertsCleared++;
+        }
+    }
+
+    ReplayUnit& GetUnit(uint8_t unit) {
+        if (unit >= units.size()) {
+            units.resize(unit + 1);
+        }
+        return units[unit];
+    }
+
+    // As GetPrimaryEnvUnit: the first unit with any sensor initialised
+    const ReplayUnit* GetPrimaryUnit() const {
+        for (const ReplayUnit& unit : units) {
+            if (unit.sensorMask != 0) {
+                return &unit;
+            }
+        }
+        return nullptr;
+    }
+
+    void OnLinkState(const RecordingEvent& event) {
+        if (event.link == RECORDING_LINK_WIFI) {
+            bool isConnected = event.state == RECORDING_WIFI_STATE_CONNECTED;
+            if (isConnected && !recordedLink.isWifiConnected && hasWifiConnected) {
+                metrics.recordedWifiReconnects++;
+            }
+            hasWifiConnected = hasWifiConnected || isConnected;
+            recordedLink.isWifiConnected = isConnected;
+        } else if (event.link == RECORDING_LINK_WIFI_CLIENT) {
+            recordedLink.isWifiClientConnected = event.state != 0;
+        } else if (event.link == RECORDING_LINK_MQTT) {
+            recordedLink.isMqttConnected = event.state == RECORDING_MQTT_STATE_CONNECTED;
+            recordedMqtt.Update(event.millis, recordedLink.isMqttConnected,
+                metrics.recordedMqttReconnects, metrics.recordedMqttOutageMillis);
+        } else if (event.link == RECORDING_LINK_NTP) {
+            recordedLink.hasRtcSynced = event.state != 0;
+        }
+    }
+
+    // As EvaluateAlerts, UpdateComfortMetrics and RecordHistorySample
+    void ReplaySensors(uint32_t millis, const ReplayUnit* primary) {
+        for (const ReplayUnit& unit : units) {
+            if (unit.hasState) {
+                ruleEngine.Evaluate(millis, unit.channel, unit.values);
+            }
+        }
+
+        if (primary == nullptr) {
+            return;
+        }
+
+        if (primary->sensorMask & (1 << RECORDING_SENSOR_SHT4X)) {
+            float dewPoint = CalculateDewPoint(primary->values[HISTORY_SHT4X_TEMPERATURE],
+                primary->values[HISTORY_SHT4X_HUMIDITY]);
+
+            if (!isnan(dewPoint)) {
+                metrics.dewPointMin = isnan(metrics.dewPointMin) ? dewPoint : std::min(metrics.dewPointMin, dewPoint);
+                metrics.dewPointMax = isnan(metrics.dewPointMax) ? dewPoint : std::max(metrics.dewPointMax, dewPoint);
+            }
+        }
+
+        if (!recordedLink.hasRtcSynced) {
+            return;
+        }
+
+        // HistoryStore drops samples which don't move the clock on
+        HistorySample sample;
+        sample.timestamp = REPLAY_HISTORY_EPOCH + millis / 1000;
+        if (sample.timestamp <= lastHistoryTimestamp) {
+            return;
+        }
+        lastHistoryTimestamp = sample.timestamp;
+        memcpy(sample.values, primary->values, sizeof(sample.values));
+
+        if (!historyEncoder.Append(sample)) {
+            metrics.historyChunks++;
+            metrics.historyBytes += sizeof(HistoryChunkHeader) + historyEncoder.SizeBytes();
+
+            historyEncoder.Reset();
+            historyEncoder.Append(sample);
+        }
+        metrics.historySamples++;
+    }
+
+    // As UpdateAndDisplayWiFiClientStatus and UpdateAndDisplayMqttClientStatus
+    void ReplayConnections(uint32_t millis) {
+        // A connection the recorded firmware lost is lost here too
+        isWifiClientConnected = isWifiClientConnected && recordedLink.isWifiClientConnected;
+
+        if (!isWifiClientConnected && recordedLink.isWifiConnected && wifiClientConnectPacer.IsDue(millis)) {
+            isWifiClientConnected = recordedLink.isWifiClientConnected;
+            wifiClientConnectPacer.OnAttempt(millis, isWifiClientConnected);
+
+            metrics.wifiClientAttempts++;
+            if (!isWifiClientConnected) {
+                metrics.wifiClientFailures++;
+            }
+        }
+
+        isMqttConnected = isMqttConnected && isWifiClientConnected && recordedLink.isMqttConnected;
+
+        if (!isMqttConnected && isWifiClientConnected && mqttConnectPacer.IsDue(millis)) {
+            isMqttConnected = recordedLink.isMqttConnected;
+            mqttConnectPacer.OnAttempt(millis, isMqttConnected);
+
+            metrics.mqttAttempts++;
+            if (!isMqttConnected) {
+                metrics.mqttFailures++;
+            }
+        }
+
+        replayedMqtt.Update(millis, isMqttConnected, metrics.mqttReconnects, metrics.mqttOutageMillis);
+    }
+
+    // Runs the loop's decisions once its readings and link states are all known
+    void FinishLoop() {
+        if (!currentLoop.isActive) {
+            return;
+        }
+
+        metrics.loops++;
+
+        const ReplayUnit* primary = GetPrimaryUnit();
+
+        ReplaySensors(currentLoop.millis, primary);
+        ReplayConnections(currentLoop.millis);
+
+        bool hasSensorData = primary != nullptr;
+        if (!hasSensorData) {
+            metrics.loopsWithoutSensorData++;
+        }
+
+        LinkStatus link;
+        link.isWifiConnected = recordedLink.isWifiConnected;
+        link.isWifiClientConnected = isWifiClientConnected;
+        link.isMqttConnected = isMqttConnected;
+        link.hasRtcSynced = recordedLink.hasRtcSynced;
+
+        PublishDecision decision = scheduler.OnLoop(link, hasSensorData);
+
+        if (decision == PUBLISH_SEND) {
+            // Reuse the recorded outcome where the recorded firmware also sent this loop
+            bool isSent = link.isMqttConnected;
+            if (currentLoop.hasRecordedPublish && currentLoop.recordedDecision == PUBLISH_SEND) {
+                isSent = currentLoop.recordedIsSent;
+            }
+
+            scheduler.OnPublishResult(isSent);
+
+            if (isSent) {
+                metrics.publishesSent++;
+
+                if (metrics.firstPublishMillis < 0) {
+                    metrics.firstPublishMillis = currentLoop.millis - startMillis;
+                } else {
+                    metrics.publishIntervals.push_back(currentLoop.millis - lastPublishMillis);
+                }
+                lastPublishMillis = currentLoop.millis;
+            } else {
+                metrics.publishesFailed++;
+            }
+        } else if (decision == PUBLISH_REFUSED_DISCONNECTED) {
+            metrics.refusedDisconnected++;
+        } else if (decision == PUBLISH_REFUSED_NOT_SYNCED) {
+            metrics.refusedNotSynced++;
+        } else if (decision == PUBLISH_REFUSED_NO_DATA) {
+            metrics.refusedNoData++;
+        }
+
+        currentLoop.isActive = false;
+    }
+
+    PublishScheduler scheduler;
+    RuleEngine ruleEngine;
+    ConnectPacer wifiClientConnectPacer;
+    ConnectPacer mqttConnectPacer;
+
+    uint8_t historyChunk[HISTORY_CHUNK_BYTES];
+    HistoryChunkEncoder historyEncoder;
+    uint32_t lastHistoryTimestamp = 0;
+
+    LinkStatus recordedLink = {};
+    bool isWifiClientConnected = false;
+    bool isMqttConnected = false;
+
+    ReplayLoop currentLoop;
+    std::vector<ReplayUnit> units;
+
+    bool hasStarted = false;
+    uint32_t startMillis = 0;
+    uint32_t lastMillis = 0;
+    uint32_t lastPublishMillis = 0;
+
+    bool hasWifiConnected = false;
+    OutageCounter recordedMqtt;
+    OutageCounter replayedMqtt;
+
+    ReplayMetrics metrics;
+};
+
+static uint32_t Percentile(std::vector<uint32_t> values, double percentile) {
+    if (values.empty()) {
+        return 0;
+    }
+
+    std::sort(values.begin(), values.end());
+    size_t index = (size_t)ceil(percentile / 100.0 * values.size()) - 1;
+    return values[std::min(index, values.size() - 1)];
+}
+
+// JSON has no NAN
+static void PrintFloat(const char* name, float value) {
+    if (isnan(value)) {
+        printf("  \"%s\": null,\n", name);
+    } else {
+        printf("  \"%s\": %.2f,\n", name, value);
+    }
+}
+
+static void PrintMetrics(const ReplayMetrics& metrics) {
+    uint32_t drops = metrics.publishesFailed + metrics.refusedDisconnected
+        + metrics.refusedNotSynced + metrics.refusedNoData;
+
+    printf("{\n");
+    printf("  \"durationMs\": %u,\n", metrics.durationMillis);
+    printf("  \"loops\": %u,\n", metrics.loops);
+    printf("  \"publishesSent\": %u,\n", metrics.publishesSent);
+    printf("  \"drops\": %u,\n", drops);
+    printf("  \"publishesFailed\": %u,\n", metrics.publishesFailed);
+    printf("  \"refusedDisconnected\": %u,\n", metrics.refusedDisconnected);
+    printf("  \"refusedNotSynced\": %u,\n", metrics.refusedNotSynced);
+    printf("  \"refusedNoData\": %u,\n", metrics.refusedNoData);
+    printf("  \"firstPublishMs\": %lld,\n", (long long)metrics.firstPublishMillis);
+    printf("  \"publishIntervalP50Ms\": %u,\n", Percentile(metrics.publishIntervals, 50));
+    printf("  \"publishIntervalP95Ms\": %u,\n", Percentile(metrics.publishIntervals, 95));
+    printf("  \"publishIntervalMaxMs\": %u,\n", Percentile(metrics.publishIntervals, 100));
+    printf("  \"loopsWithoutSensorData\": %u,\n", metrics.loopsWithoutSensorData);
+    printf("  \"alertsTriggered\": %u,\n", metrics.alertsTriggered);
+    printf("  \"alertsCleared\": %u,\n", metrics.alertsCleared);
+    printf("  \"historySamples\": %u,\n", metrics.historySamples);
+    printf("  \"historyChunks\": %u,\n", metrics.historyChunks);
+    printf("  \"historyBytes\": %u,\n", metrics.historyBytes);
+    PrintFloat("dewPointMinC", metrics.dewPointMin);
+    PrintFloat("dewPointMaxC", metrics.dewPointMax);
+    printf("  \"wifiClientAttempts\": %u,\n", metrics.wifiClientAttempts);
+    printf("  \"wifiClientFailures\": %u,\n", metrics.wifiClientFailures);
+    printf("  \"mqttAttempts\": %u,\n", metrics.mqttAttempts);
+    printf("  \"mqttFailures\": %u,\n", metrics.mqttFailures);
+    printf("  \"mqttReconnects\": %u,\n", metrics.mqttReconnects);
+    printf("  \"mqttOutageMs\": %u,\n", metrics.mqttOutageMillis);
+    printf("  \"recorded\": {\n");
+    printf("    \"publishesSent\": %u,\n", metrics.recordedPublishesSent);
+    printf("    \"wifiReconnects\": %u,\n", metrics.recordedWifiReconnects);
+    printf("    \"mqttReconnects\": %u,\n", metrics.recordedMqttReconnects);
+    printf("    \"mqttOutageMs\": %u,\n", metrics.recordedMqttOutageMillis);
+    printf("    \"i2cErrors\": %u\n", metrics.recordedI2cErrors);
+    printf("  }\n");
+    printf("}\n");
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "Usage: %s <recording.bin | serial log> [rules file]\n", argv[0]);
+        return 1;
+    }
+
+    std::string rules = ALERT_DEFAULT_RULES;
+    if (argc == 3) {
+        std::vector<uint8_t> rulesFile;
+        if (!ReadFile(argv[2], rulesFile)) {
+            fprintf(stderr, "Couldn't read %s\n", argv[2]);
+            return 1;
+        }
+        rules.assign(rulesFile.begin(), rulesFile.end());
+    }
+
+    std::vector<uint8_t> file;
+    if (!ReadFile(argv[1], file)) {
+        fprintf(stderr, "Couldn't read %s\n", argv[1]);
+        return 1;
+    }
+
+    std::vector<uint8_t> data;
+    if (file.size() >= 4 && memcmp(file.data(), RECORDING_MAGIC, 4) == 0) {
+        data = file;
+    } else if (!DecodeHexDump(file, data)) {
+        fprintf(stderr, "No recording found in %s\n", argv[1]);
+        return 1;
+    }
+
+    RecordingReader reader(data.data(), data.size());
+    if (!reader.IsValid()) {
+        fprintf(stderr, "Not a version %d recording\n", RECORDING_VERSION);
+        return 1;
+    }
+
+    static Replay replay;
+    int errorLine;
+    if (!replay.LoadRules(rules.c_str(), errorLine)) {
+        fprintf(stderr, "Invalid rule on line %d\n", errorLine);
+        return 1;
+    }
+
+    RecordingEvent event;
+    while (reader.Next(event)) {
+        replay.OnEvent(event);
+    }
+
+    PrintMetrics(replay.Finish());
+
+    return 0;
+}
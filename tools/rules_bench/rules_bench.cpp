@@ -0,0 +1,204 @@
+// Measures the cost of evaluating alert rules on the host.
+//
+// Build from the repository root:
+//   g++ -std=gnu++17 -O2 -Ilib/Trace -Ilib/Rules -Ilib/TimeSeries tools/rules_bench/rules_bench.cpp lib/Rules/RuleEngine.cpp -o rules_bench
+//
+// Run:
+//   ./rules_bench [rules file]
+//
+// Without a file, RULES_MAX_RULES rules covering every kind are applied to every channel.
+// Samples are a random walk at one per second, with CO2 surges so rules trigger and clear.
+// Host timings only give the relative cost; the ESP32 is roughly 20-50x slower.
+//
+// First checks that rules match on the channel, and that stale only follows failed reads,
+// exiting non-zero if either doesn't hold.
+
+#include <math.h>
+#include <stdio.h>
+
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <RuleEngine.h>
+
+#define BENCH_SAMPLES 200000
+
+static const char* const defaultRules =
+    "# Every kind of rule, on every unit\n"
+    "co2_high * scd4x_co2 above 1500 1400\n"
+    "co2_surge * scd4x_co2 rise 300 120\n"
+    "co2_drop * scd4x_co2 fall 300 120\n"
+    "too_hot * sht4x_temperature above 30 29\n"
+    "too_cold * sht4x_temperature below 15 16\n"
+    "damp * sht4x_humidity above 70 65\n"
+    "temp_stale * sht4x_temperature stale 60\n"
+    "co2_stale * scd4x_co2 stale 60\n";
+
+static uint32_t alertCount = 0;
+
+static void CountAlert(const RuleAlert&, void*) {
+    alertCount++;
+}
+
+struct CheckAlerts {
+    int triggered;
+    int cleared;
+    uint8_t lastChannel;
+};
+
+static void CollectAlert(const RuleAlert& alert, void* context) {
+    CheckAlerts* alerts = (CheckAlerts*)context;
+
+    if (alert.isTriggered) {
+        alerts->triggered++;
+    } else {
+        alerts->cleared++;
+    }
+    alerts->lastChannel = alert.channel;
+}
+
+static bool CheckRules() {
+    // The first channel of a hub at 0x71 is labelled "6"
+    static const char* const checkRules =
+        "co2_high 6 scd4x_co2 above 1500 1400\n"
+        "temp_stale bus sht4x_temperature stale 60\n";
+
+    RuleEngine engine;
+    int errorLine;
+    if (!engine.LoadConfig(checkRules, errorLine)) {
+        fprintf(stderr, "Invalid check rule on line %d\n", errorLine);
+        return false;
+    }
+
+    CheckAlerts alerts = {};
+    engine.SetAlertSink(CollectAlert, &alerts);
+
+    float values[RULES_FIELD_COUNT];
+    for (int field = 0; field < RULES_FIELD_COUNT; field++) {
+        values[field] = 21.0f;
+    }
+    values[HISTORY_SCD4X_CO2] = 1600.0f;
+
+    // Only the unit on channel 6 matches, whatever its index
+    engine.Evaluate(0, 5, values);
+    engine.Evaluate(0, 7, values);
+    bool isOtherChannelQuiet = alerts.triggered == 0;
+    engine.Evaluate(0, 6, values);
+    bool isChannelMatched = alerts.triggered == 1 && alerts.lastChannel == 6;
+
+    // A steady reading on the main bus for ten minutes isn't stale
+    values[HISTORY_SCD4X_CO2] = 600.0f;
+    alerts = {};
+    for (uint32_t second = 0; second <= 600; second++) {
+        engine.Evaluate(second * 1000, 0, values);
+    }
+    bool isSteadyFresh = alerts.triggered == 0;
+
+    // Failed reads for a minute are, and a successful read clears it
+    values[HISTORY_SHT4X_TEMPERATURE] = NAN;
+    for (uint32_t second = 601; second <= 661; second++) {
+        engine.Evaluate(second * 1000, 0, values);
+    }
+    bool isFailedStale = alerts.triggered == 1;
+    values[HISTORY_SHT4X_TEMPERATURE] = 21.0f;
+    engine.Evaluate(662 * 1000, 0, values);
+    bool isReadCleared = alerts.cleared == 1;
+
+    printf("Rule on another channel is quiet: %s\n", isOtherChannelQuiet ? "ok" : "FAIL");
+    printf("Rule matches its channel: %s\n", isChannelMatched ? "ok" : "FAIL");
+    printf("Steady reading isn't stale: %s\n", isSteadyFresh ? "ok" : "FAIL");
+    printf("Failed reads are stale: %s\n", isFailedStale ? "ok" : "FAIL");
+    printf("Successful read clears stale: %s\n", isReadCleared ? "ok" : "FAIL");
+
+    return isOtherChannelQuiet && isChannelMatched && isSteadyFresh && isFailedStale && isReadCleared;
+}
+
+int main(int argc, char** argv) {
+    if (!CheckRules()) {
+        return 1;
+    }
+
+    std::string config = defaultRules;
+
+    if (argc > 1) {
+        std::ifstream file(argv[1]);
+        if (!file) {
+            fprintf(stderr, "Couldn't read %s\n", argv[1]);
+            return 1;
+        }
+
+        std::stringstream contents;
+        contents << file.rdbuf();
+        config = contents.str();
+    }
+
+    RuleEngine engine;
+    int errorLine;
+    if (!engine.LoadConfig(config.c_str(), errorLine)) {
+        fprintf(stderr, "Invalid rule on line %d\n", errorLine);
+        return 1;
+    }
+
+    engine.SetAlertSink(CountAlert, nullptr);
+
+    // Generate the samples up front so only evaluation is timed
+    std::mt19937 random(1);
+    std::normal_distribution<float> step(0.0f, 0.05f);
+
+    std::vector<float> samples((size_t)BENCH_SAMPLES * RULES_FIELD_COUNT);
+    const float baseValues[RULES_FIELD_COUNT] = { 21.0f, 45.0f, 21.5f, 101325.0f, 22.0f, 44.0f, 600.0f };
+    float values[RULES_FIELD_COUNT];
+    for (int field = 0; field < RULES_FIELD_COUNT; field++) {
+        values[field] = baseValues[field];
+    }
+
+    for (int i = 0; i < BENCH_SAMPLES; i++) {
+        // Drifting around the base values
+        for (int field = 0; field < HISTORY_SCD4X_CO2; field++) {
+            float scale = field == HISTORY_BMP280_PRESSURE ? 20.0f : 1.0f;
+            values[field] += step(random) * scale + (baseValues[field] - values[field]) * 0.001f;
+        }
+
+        // The SCD4x only produces a new value every 5 seconds.
+        // A surge every 10 minutes, lasting a minute.
+        if (i % 5 == 0) {
+            bool isSurging = i % 600 < 60;
+            values[HISTORY_SCD4X_CO2] = isSurging
+                ? values[HISTORY_SCD4X_CO2] + 80.0f
+                : values[HISTORY_SCD4X_CO2] + (600.0f - values[HISTORY_SCD4X_CO2]) * 0.2f;
+        }
+
+        for (int field = 0; field < RULES_FIELD_COUNT; field++) {
+            samples[(size_t)i * RULES_FIELD_COUNT + field] = values[field];
+        }
+    }
+
+    auto startedAt = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < BENCH_SAMPLES; i++) {
+        uint32_t millis = (uint32_t)i * 1000;
+
+        for (uint8_t channel = 0; channel < RULES_MAX_UNITS; channel++) {
+            engine.Evaluate(millis, channel, &samples[(size_t)i * RULES_FIELD_COUNT]);
+        }
+    }
+
+    auto elapsed = std::chrono::steady_clock::now() - startedAt;
+    double elapsedNanos = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+
+    double unitSamples = (double)BENCH_SAMPLES * RULES_MAX_UNITS;
+    double ruleEvaluations = unitSamples * engine.GetRuleCount();
+
+    printf("Rules: %d\n", engine.GetRuleCount());
+    printf("Unit samples: %.0f\n", unitSamples);
+    printf("Alerts: %u\n", alertCount);
+    printf("Per unit sample: %.1fns\n", elapsedNanos / unitSamples);
+    printf("Per rule evaluation: %.1fns\n", ruleEvaluations > 0 ? elapsedNanos / ruleEvaluations : 0.0);
+    printf("Engine size: %zu bytes\n", sizeof(RuleEngine));
+
+    return 0;
+}
@@ -0,0 +1,32 @@
+#!/bin/sh
+# Creates a CA and a broker certificate for a local TLS Mosquitto.
+# P-256 keys keep the full handshake cheap on the ESP32.
+#
+# Usage: tools/tls_broker/make_certs.sh <broker hostname>
+
+set -e
+
+HOST="${1:?Usage: $0 <broker hostname>}"
+DIR="$(dirname "$0")/certs"
+
+mkdir -p "$DIR"
+cd "$DIR"
+
+openssl ecparam -name prime256v1 -genkey -noout -out ca.key
+openssl req -x509 -new -key ca.key -sha256 -days 3650 -subj "/CN=thermo_iot CA" -out ca.crt
+
+openssl ecparam -name prime256v1 -genkey -noout -out server.key
+openssl req -new -key server.key -subj "/CN=$HOST" -out server.csr
+printf "subjectAltName=DNS:%s\n" "$HOST" > server.ext
+openssl x509 -req -in server.csr -CA ca.crt -CAkey ca.key -CAcreateserial -sha256 -days 825 -extfile server.ext -out server.crt
+
+rm server.csr server.ext
+
+echo
+echo "Add to src/secrets.h:"
+echo
+echo "#define SECRET_MQTT_USE_TLS"
+echo "#define SECRET_MQTT_PORT 8883"
+printf '#define SECRET_MQTT_CA_CERT \\\n'
+sed 's/.*/    "&\\n" \\/' ca.crt
+echo '    ""'
@@ -0,0 +1,271 @@
+// Runs the tracer on the host over the shared libs' loop paths: the ring buffer, nesting and the dump.
+//
+// Build from the repository root:
+//   g++ -std=gnu++17 -O2 -DTHERMO_TRACE -Ilib/Trace -Ilib/Power -Ilib/Publish -Ilib/Rules -Ilib/TimeSeries
+//       tools/trace_host/trace_host.cpp lib/Trace/Trace.cpp lib/Power/PowerGovernor.cpp
+//       lib/Publish/PublishScheduler.cpp lib/Rules/RuleEngine.cpp lib/TimeSeries/TimeSeriesCodec.cpp
+//       -o trace_host -lpthread
+//
+// Run, converting the dump as for one from the device:
+//   ./trace_host dump.txt
+//   python3 tools/trace_to_chrome.py dump.txt trace.json
+//
+// Each loop runs what loop() hands to the libs, inside a "loop" scope: the power governor,
+// the alert rules per unit, the history encoder and the publish scheduler, with drifting
+// sensor values one second apart. A second thread records events alongside it, as the WiFi
+// event task does on the device, and more events are recorded than the buffer holds.
+// Checks that the buffer keeps the newest TRACE_BUFFER_EVENTS events in order, that the libs'
+// scopes end inside their loop, and that MeasureTraceDump matches the dump's length.
+// Built without THERMO_TRACE, checks that the dump is the disabled marker.
+// Exits non-zero if any check fails.
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <PowerGovernor.h>
+#include <PublishScheduler.h>
+#include <RuleEngine.h>
+#include <TimeSeriesCodec.h>
+#include <Trace.h>
+
+#define HOST_LOOPS 20000
+#define HOST_UNITS 2
+
+// Each loop records the loop, the governor, a rule pass per unit, the encoder and the scheduler
+#define HOST_EVENTS_PER_LOOP (4 + HOST_UNITS)
+
+// Far more often than WiFi events arrive
+#define HOST_EVENT_INTERVAL_US 50
+
+#define HOST_START_TIMESTAMP 1700000000UL
+
+static const char* const hostRules =
+    "co2_high * scd4x_co2 above 1500 1400\n"
+    "co2_surge * scd4x_co2 rise 300 120\n"
+    "too_hot * sht4x_temperature above 30 29\n"
+    "temp_stale * sht4x_temperature stale 60\n";
+
+static bool isPassing = true;
+
+static void Check(bool condition, const char* description) {
+    printf("%-48s %s\n", description, condition ? "ok" : "FAIL");
+    isPassing = isPassing && condition;
+}
+
+static void IgnoreAlert(const RuleAlert&, void*) {
+}
+
+struct HostLoop {
+    PowerGovernor powerGovernor;
+    RuleEngine ruleEngine;
+    PublishScheduler publishScheduler;
+    uint8_t chunk[HISTORY_CHUNK_BYTES];
+    HistoryChunkEncoder encoder;
+    int publishCount;
+
+    HostLoop() : encoder(chunk, sizeof(chunk)), publishCount(0) {
+    }
+};
+
+static void RunLoop(HostLoop& host, int index) {
+    TRACE_SCOPE("loop");
+
+    uint32_t millis = index * 1000;
+
+    BatteryStatus battery = { 90 - index / 400, false, true };
+    host.powerGovernor.Update(millis, battery);
+
+    HistorySample sample;
+    sample.timestamp = HOST_START_TIMESTAMP + index;
+    for (int field = 0; field < HISTORY_FIELD_COUNT; field++) {
+        sample.values[field] = 20.0f + field + 0.5f * sinf(index * 0.1f + field);
+    }
+    sample.values[HISTORY_SCD4X_CO2] = 600.0f + 10.0f * (index % 200);
+
+    for (uint8_t channel = 0; channel < HOST_UNITS; channel++) {
+        host.ruleEngine.Evaluate(millis, channel, sample.values);
+    }
+
+    if (!host.encoder.Append(sample)) {
+        host.encoder.Reset();
+        host.encoder.Append(sample);
+    }
+
+    LinkStatus link = { true, true, true, true };
+    if (host.publishScheduler.OnLoop(link, true) == PUBLISH_SEND) {
+        host.publishScheduler.OnPublishResult(true);
+        host.publishCount++;
+    }
+}
+
+// Only records events between the loop's, the event task's own work isn't modelled
+static void SimulateEventTask(const std::atomic<bool>* isRunning) {
+    while (isRunning->load()) {
+        {
+            TRACE_SCOPE("OnWiFiEvent");
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(HOST_EVENT_INTERVAL_US));
+    }
+}
+
+static void CollectLine(const char* line, void* context) {
+    std::vector<std::string>* lines = (std::vector<std::string>*)context;
+    lines->push_back(line);
+}
+
+struct ParsedEvent {
+    std::string name;
+    uint32_t start;
+    uint32_t duration;
+};
+
+static bool ParseEvent(const std::string& line, ParsedEvent& event) {
+    char name[64];
+    unsigned core;
+    unsigned long start;
+    unsigned long duration;
+
+    if (sscanf(line.c_str(), "%63[^,],%u,%lu,%lu", name, &core, &start, &duration) != 4) {
+        return false;
+    }
+
+    event.name = name;
+    event.start = (uint32_t)start;
+    event.duration = (uint32_t)duration;
+    return true;
+}
+
+static int CheckDisabled() {
+    std::vector<std::string> lines;
+    WriteTraceDump(CollectLine, &lines);
+
+    Check(!IsTraceEnabled(), "Tracing reports disabled");
+    Check(lines.size() == 1 && lines[0] == "# thermo_iot trace,disabled", "Dump is the disabled marker");
+    Check(MeasureTraceDump() == lines[0].size() + 1, "Measured length matches");
+
+    return isPassing ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+    if (!IsTraceEnabled()) {
+        return CheckDisabled();
+    }
+
+    static HostLoop host;
+    int errorLine;
+    if (!host.ruleEngine.LoadConfig(hostRules, errorLine)) {
+        fprintf(stderr, "Invalid rule on line %d\n", errorLine);
+        return 1;
+    }
+    host.ruleEngine.SetAlertSink(IgnoreAlert, nullptr);
+
+    ResetTrace();
+
+    std::atomic<bool> isRunning(true);
+    std::thread eventTask(SimulateEventTask, &isRunning);
+
+    auto startedAt = std::chrono::steady_clock::now();
+    for (int i = 0; i < HOST_LOOPS; i++) {
+        RunLoop(host, i);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - startedAt;
+
+    isRunning.store(false);
+    eventTask.join();
+
+    SetTracePaused(true);
+
+    // Recorded while paused, so it must not appear
+    {
+        TRACE_SCOPE("paused");
+    }
+
+    std::vector<std::string> lines;
+    WriteTraceDump(CollectLine, &lines);
+
+    size_t dumpLength = 0;
+    for (const std::string& line : lines) {
+        dumpLength += line.size() + 1;
+    }
+
+    unsigned long events = 0;
+    unsigned long dropped = 0;
+    sscanf(lines[0].c_str(), "# thermo_iot trace,cycles_per_us=%*u,events=%lu,dropped=%lu", &events, &dropped);
+
+    Check(events == TRACE_BUFFER_EVENTS, "Buffer holds TRACE_BUFFER_EVENTS events");
+    Check(lines.size() == events + 1, "One line per event after the header");
+    Check(dropped >= HOST_LOOPS * HOST_EVENTS_PER_LOOP - TRACE_BUFFER_EVENTS, "Older events are counted as dropped");
+    Check(MeasureTraceDump() == dumpLength, "Measured length matches the dump");
+
+    // Events are recorded as they end, so end times never go backwards on one thread.
+    // Each lib scope must lie within the loop which follows it.
+    // The host clock wraps every ~4s, like the cycle counter, so times are compared by difference.
+    bool isInOrder = true;
+    bool isNested = true;
+    bool hasPaused = false;
+    bool hasLoop = false;
+    uint32_t lastLoopEnd = 0;
+    bool hasLibEvents = false;
+    std::vector<ParsedEvent> pendingCalls;
+
+    for (size_t i = 1; i < lines.size(); i++) {
+        ParsedEvent event;
+        if (!ParseEvent(lines[i], event)) {
+            isInOrder = false;
+            break;
+        }
+
+        uint32_t end = event.start + event.duration;
+        hasPaused = hasPaused || event.name == "paused";
+
+        if (event.name == "loop") {
+            for (const ParsedEvent& call : pendingCalls) {
+                uint32_t callEnd = call.start + call.duration;
+                isNested = isNested
+                    && (uint32_t)(call.start - event.start) <= event.duration
+                    && (uint32_t)(callEnd - event.start) <= event.duration;
+            }
+            hasLibEvents = hasLibEvents || !pendingCalls.empty();
+            pendingCalls.clear();
+
+            isInOrder = isInOrder && (!hasLoop || (int32_t)(end - lastLoopEnd) >= 0);
+            hasLoop = true;
+            lastLoopEnd = end;
+        } else if (event.name != "OnWiFiEvent" && event.name != "paused") {
+            pendingCalls.push_back(event);
+        }
+    }
+
+    Check(isInOrder, "Loop events are in order");
+    Check(hasLibEvents, "Lib scopes are recorded");
+    Check(isNested, "Lib scopes lie inside their loop");
+    Check(!hasPaused, "Nothing is recorded while paused");
+
+    SetTracePaused(false);
+
+    double loopNanos = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / HOST_LOOPS;
+    printf("Loop: %.1fus, %d publishes\n", loopNanos / 1000.0, host.publishCount);
+
+    if (argc > 1) {
+        FILE* dump = fopen(argv[1], "w");
+        if (dump == nullptr) {
+            fprintf(stderr, "Couldn't write %s\n", argv[1]);
+            return 1;
+        }
+
+        for (const std::string& line : lines) {
+            fprintf(dump, "%s\n", line.c_str());
+        }
+        fclose(dump);
+    }
+
+    return isPassing ? 0 : 1;
+}
@@ -0,0 +1,140 @@
+#!/usr/bin/env python3
+"""Convert a thermo_iot trace dump to Chrome/Perfetto trace JSON.
+
+The dump can be pasted straight from the serial monitor (timestamp prefixes are
+ignored) or saved from the <topic>/trace MQTT message.
+
+    python3 tools/trace_to_chrome.py dump.txt trace.json
+
+Open the result in chrome://tracing or https://ui.perfetto.dev.
+"""
+
+import json
+import re
+import sys
+
+HEADER = re.compile(r"# thermo_iot trace,(.*)$")
+EVENT = re.compile(r"([^,\s>]+),(\d+),(\d+),(\d+)\s*$")
+
+WRAP = 1 << 32
+
+# Events can be recorded slightly out of order: the WiFi event task may be preempted between
+# reading the counter and claiming a slot, and the two cores' counters are only roughly aligned.
+# An end time this far behind the last is taken as out of order rather than a wrap.
+REORDER_TOLERANCE = 1 << 28
+
+
+def parse_dump(lines):
+    settings = None
+    events = []
+
+    for line in lines:
+        header = HEADER.search(line)
+        if header:
+            # Only the last dump in the file is converted
+            settings = dict(
+                field.split("=", 1) if "=" in field else (field, "")
+                for field in header.group(1).split(",")
+            )
+            events = []
+            continue
+
+        if settings is None:
+            continue
+
+        event = EVENT.search(line)
+        if event:
+            name, core, start, duration = event.groups()
+            events.append((name, int(core), int(start), int(duration)))
+
+    if settings is None:
+        raise ValueError("No trace dump found")
+
+    if "disabled" in settings:
+        raise ValueError("The firmware was built without THERMO_TRACE")
+
+    return int(settings["cycles_per_us"]), events
+
+
+def unwrap(events):
+    """Extend the 32 bit cycle counts, which wrap every ~18s at 240MHz.
+
+    Events are recorded as they end, so end times only move forward through the dump,
+    and the step from one to the next is taken modulo 2^32. That holds as long as
+    consecutive events end within ~17s of each other, which the longest (10s) loop
+    delay keeps to; an event can itself be longer than half the wrap.
+    Each start is then its end less its duration, which is exact however the counter
+    wrapped during the event.
+    Each core has its own counter, so cores are aligned only approximately.
+    """
+    unwrapped = []
+    last_end = None
+    last_end_unwrapped = 0
+
+    for name, core, start, duration in events:
+        end = (start + duration) % WRAP
+
+        if last_end is None:
+            unwrapped_end = end
+        else:
+            step = (end - last_end) % WRAP
+            if step >= WRAP - REORDER_TOLERANCE:
+                step -= WRAP
+            unwrapped_end = last_end_unwrapped + step
+
+        last_end = end
+        last_end_unwrapped = unwrapped_end
+        unwrapped.append((name, core, unwrapped_end - duration, duration))
+
+    return unwrapped
+
+
+def to_chrome_trace(cycles_per_us, events):
+    events = unwrap(events)
+    origin = min((start for _, _, start, _ in events), default=0)
+
+    trace_events = []
+    for core in sorted({core for _, core, _, _ in events}):
+        trace_events.append({
+            "name": "thread_name",
+            "ph": "M",
+            "pid": 1,
+            "tid": core,
+            "args": {"name": "Core {}".format(core)},
+        })
+
+    for name, core, start, duration in events:
+        trace_events.append({
+            "name": name,
+            "ph": "X",
+            "pid": 1,
+            "tid": core,
+            "ts": (start - origin) / cycles_per_us,
+            "dur": duration / cycles_per_us,
+        })
+
+    return {"traceEvents": trace_events, "displayTimeUnit": "ms"}
+
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        print(__doc__)
+        return 1
+
+    with open(sys.argv[1], errors="replace") as dump:
+        cycles_per_us, events = parse_dump(dump)
+
+    trace = to_chrome_trace(cycles_per_us, events)
+
+    if len(sys.argv) == 3:
+        with open(sys.argv[2], "w") as output:
+            json.dump(trace, output)
+    else:
+        json.dump(trace, sys.stdout)
+
+    print("Converted {} events".format(len(events)), file=sys.stderr)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())